@@ -0,0 +1,352 @@
+#include "definitions.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <string.h>
+#include <signal.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// Default frame rate written to Y4M headers
+#define CAPTURE_FPS 60
+
+/******************************************************
+ * Stream formats and what to do when the writer
+ * thread falls behind the renderer.
+ *****************************************************/
+enum CAPTURE_FORMAT
+{
+    CAPTURE_PPM,    // Concatenated binary RGB PPM images
+    CAPTURE_Y4M     // YUV4MPEG2, 4:2:0 (BT.601, full range)
+};
+
+enum CAPTURE_POLICY
+{
+    CAPTURE_DROP,   // Skip the frame, counted in 'dropped'
+    CAPTURE_BLOCK   // Wait for a free slot
+};
+
+/****************************************************
+ * ARGB_TO_LUMA
+ * Y plane of one row, 4 pixels per SSE2 step.
+ ***************************************************/
+inline void ARGBToLumaRow(const PIXEL* src, Uint8* dst, const int & w)
+{
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i coef = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);    // B, G, R, A
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    for(; x + 4 <= w; x += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+        __m128 loF = _mm_castsi128_ps(lo);
+        __m128 hiF = _mm_castsi128_ps(hi);
+        __m128i bg = _mm_castps_si128(_mm_shuffle_ps(loF, hiF, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i ra = _mm_castps_si128(_mm_shuffle_ps(loF, hiF, _MM_SHUFFLE(3, 1, 3, 1)));
+        __m128i y = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(bg, ra), round), 8);
+        y = _mm_packs_epi32(y, y);
+        y = _mm_packus_epi16(y, y);
+        int packed = _mm_cvtsi128_si32(y);
+        memcpy(dst + x, &packed, 4);
+    }
+#endif
+    for(; x < w; x++)
+    {
+        PIXEL p = src[x];
+        dst[x] = (Uint8)((77 * ((p >> 16) & 0xff) + 150 * ((p >> 8) & 0xff) + 29 * (p & 0xff) + 128) >> 8);
+    }
+}
+
+/****************************************************
+ * ARGB_TO_CHROMA
+ * U and V of one output row from two source rows,
+ * each sample averaging a 2x2 block. 4 samples (8
+ * source columns) per SSE2 step.
+ ***************************************************/
+inline void ARGBToChromaRow(const PIXEL* top, const PIXEL* bottom, Uint8* u, Uint8* v, const int & w)
+{
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i coefU = _mm_setr_epi16(128, -85, -43, 0, 128, -85, -43, 0);     // B, G, R, A
+    const __m128i coefV = _mm_setr_epi16(-21, -107, 128, 0, -21, -107, 128, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    for(; x + 8 <= w; x += 8)
+    {
+        // Column pairs summed over both rows, 16-bit B,G,R,A per pair
+        __m128i sums[2];
+        for(int half = 0; half < 2; half++)
+        {
+            __m128i t = _mm_loadu_si128((const __m128i*)(top + x + half * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*)(bottom + x + half * 4));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(t, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(t, zero), _mm_unpackhi_epi8(b, zero));
+            __m128i quad = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sums[half] = _mm_srli_epi16(_mm_add_epi16(quad, two), 2);
+        }
+
+        // Dot products per sample, then >> 8 and offset like the scalar path
+        __m128i planes[2];
+        const __m128i coefs[2] = {coefU, coefV};
+        for(int p = 0; p < 2; p++)
+        {
+            __m128i d0 = _mm_madd_epi16(sums[0], coefs[p]);
+            __m128i d1 = _mm_madd_epi16(sums[1], coefs[p]);
+            d0 = _mm_add_epi32(d0, _mm_srli_epi64(d0, 32));
+            d1 = _mm_add_epi32(d1, _mm_srli_epi64(d1, 32));
+            __m128i dot = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(d0), _mm_castsi128_ps(d1), _MM_SHUFFLE(2, 0, 2, 0)));
+            dot = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(dot, round), 8), round);
+            dot = _mm_packs_epi32(dot, dot);
+            planes[p] = _mm_packus_epi16(dot, dot);
+        }
+        int packedU = _mm_cvtsi128_si32(planes[0]);
+        int packedV = _mm_cvtsi128_si32(planes[1]);
+        memcpy(u + x / 2, &packedU, 4);
+        memcpy(v + x / 2, &packedV, 4);
+    }
+#endif
+    for(; x < w; x += 2)
+    {
+        int x1 = MIN(x + 1, w - 1);
+        PIXEL p[4] = {top[x], top[x1], bottom[x], bottom[x1]};
+        int r = 0;
+        int g = 0;
+        int b = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            r += (p[i] >> 16) & 0xff;
+            g += (p[i] >> 8) & 0xff;
+            b += p[i] & 0xff;
+        }
+        r = (r + 2) >> 2;
+        g = (g + 2) >> 2;
+        b = (b + 2) >> 2;
+        int cu = ((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128;
+        int cv = ((128 * r - 107 * g - 21 * b + 128) >> 8) + 128;
+        u[x / 2] = (Uint8)(cu > 255 ? 255 : (cu < 0 ? 0 : cu));
+        v[x / 2] = (Uint8)(cv > 255 ? 255 : (cv < 0 ? 0 : cv));
+    }
+}
+
+/****************************************************
+ * FRAME_CAPTURE:
+ * Streams rendered frames to a file, or to stdout
+ * for a path of "-", where SIGPIPE is ignored so a
+ * reader that goes away does not end the process
+ * (writes just fail). The render thread only copies
+ * the frame into a preallocated ring slot, a writer
+ * thread converts and writes it. Frames are written
+ * top row first (Buffer2D rows run bottom-up).
+ ***************************************************/
+class FrameCapture
+{
+    protected:
+        FILE* out;
+        bool ownFile;
+        int w;
+        int h;
+        CAPTURE_FORMAT format;
+        CAPTURE_POLICY policy;
+        std::vector<PIXEL*> ring;
+        int head;                   // Next slot to fill
+        int tail;                   // Next slot to write
+        int pending;
+        bool stopping;
+        std::mutex lock;
+        std::condition_variable filled;
+        std::condition_variable freed;
+        std::thread writer;
+        Uint8* scratch;
+
+        // Copying would share the writer thread
+        FrameCapture(const FrameCapture &);
+        FrameCapture& operator=(const FrameCapture &);
+
+        void writeFrame(const PIXEL* frame)
+        {
+            if(format == CAPTURE_PPM)
+            {
+                fprintf(out, "P6\n%d %d\n255\n", w, h);
+                for(int y = 0; y < h; y++)
+                {
+                    const PIXEL* row = frame + y * w;
+                    Uint8* rgb = scratch;
+                    for(int x = 0; x < w; x++)
+                    {
+                        *rgb++ = (Uint8)(row[x] >> 16);
+                        *rgb++ = (Uint8)(row[x] >> 8);
+                        *rgb++ = (Uint8)row[x];
+                    }
+                    fwrite(scratch, 1, w * 3, out);
+                }
+            }
+            else
+            {
+                int cw = (w + 1) / 2;
+                int ch = (h + 1) / 2;
+                Uint8* luma = scratch;
+                Uint8* u = luma + w * h;
+                Uint8* v = u + cw * ch;
+                for(int y = 0; y < h; y++)
+                {
+                    ARGBToLumaRow(frame + y * w, luma + y * w, w);
+                }
+                for(int y = 0; y < ch; y++)
+                {
+                    int y1 = MIN(y * 2 + 1, h - 1);
+                    ARGBToChromaRow(frame + (y * 2) * w, frame + y1 * w, u + y * cw, v + y * cw, w);
+                }
+                fputs("FRAME\n", out);
+                fwrite(scratch, 1, w * h + cw * ch * 2, out);
+            }
+        }
+
+        void writerLoop()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while(true)
+            {
+                while(pending == 0 && !stopping)
+                {
+                    filled.wait(guard);
+                }
+                if(pending == 0)
+                {
+                    break;
+                }
+                PIXEL* frame = ring[tail];
+                guard.unlock();
+                // Stream closed or failed, keep draining without writing
+                if(!ferror(out))
+                {
+                    writeFrame(frame);
+                }
+                guard.lock();
+                tail = (tail + 1) % (int)ring.size();
+                pending--;
+                written++;
+                freed.notify_one();
+            }
+            fflush(out);
+        }
+
+    public:
+        std::atomic<Uint32> captured;
+        std::atomic<Uint32> written;
+        std::atomic<Uint32> dropped;
+
+        // 'slots' frames may be in flight, 'fps' is only recorded in Y4M headers
+        FrameCapture(const char* path, const int & wid, const int & hgt,
+                     CAPTURE_FORMAT fmt = CAPTURE_Y4M, CAPTURE_POLICY pol = CAPTURE_DROP,
+                     const int & slots = 4, const int & fps = CAPTURE_FPS)
+        {
+            w = wid;
+            h = hgt;
+            format = fmt;
+            policy = pol;
+            head = 0;
+            tail = 0;
+            pending = 0;
+            stopping = false;
+            captured = 0;
+            written = 0;
+            dropped = 0;
+            ownFile = strcmp(path, "-") != 0;
+#ifdef SIGPIPE
+            if(!ownFile)
+            {
+                signal(SIGPIPE, SIG_IGN);
+            }
+#endif
+            out = ownFile ? fopen(path, "wb") : stdout;
+            ring.resize(MAX(slots, 1));
+            for(size_t i = 0; i < ring.size(); i++)
+            {
+                ring[i] = (PIXEL*)alignedMalloc(sizeof(PIXEL) * w * h);
+            }
+            scratch = (Uint8*)malloc(MAX(w * 3, w * h + ((w + 1) / 2) * ((h + 1) / 2) * 2));
+            if(out != NULL)
+            {
+                if(format == CAPTURE_Y4M)
+                {
+                    fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", w, h, fps);
+                }
+                writer = std::thread(&FrameCapture::writerLoop, this);
+            }
+        }
+
+        // Writes everything still queued, then closes the stream
+        ~FrameCapture()
+        {
+            if(writer.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    stopping = true;
+                }
+                filled.notify_one();
+                writer.join();
+            }
+            if(out != NULL && ownFile)
+            {
+                fclose(out);
+            }
+            for(size_t i = 0; i < ring.size(); i++)
+            {
+                alignedFree(ring[i]);
+            }
+            free(scratch);
+        }
+
+        bool valid() { return out != NULL; }
+
+        // Queue a copy of 'frame', false if it was dropped
+        bool capture(Buffer2D<PIXEL> & frame)
+        {
+            if(out == NULL || frame.width() != w || frame.height() != h)
+            {
+                return false;
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            if(pending == (int)ring.size())
+            {
+                if(policy == CAPTURE_DROP)
+                {
+                    dropped++;
+                    return false;
+                }
+                while(pending == (int)ring.size())
+                {
+                    freed.wait(guard);
+                }
+            }
+            PIXEL* slot = ring[head];
+            guard.unlock();
+
+            // Only this thread fills slots, the writer won't touch it until queued
+            for(int y = 0; y < h; y++)
+            {
+                memcpy(slot + y * w, frame[h - 1 - y], sizeof(PIXEL) * w);
+            }
+
+            guard.lock();
+            head = (head + 1) % (int)ring.size();
+            pending++;
+            captured++;
+            filled.notify_one();
+            return true;
+        }
+};
+
+#endif
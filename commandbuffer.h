@@ -0,0 +1,465 @@
+#include "definitions.h"
+#include "rasterizer.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "trace.h"
+#include "workerpool.h"
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+/******************************************************
+ * DEFINES:
+ * Vertices shaded per job part at submit.
+ *****************************************************/
+#define COMMAND_SHADE_CHUNK 4096
+
+/****************************************************
+ * DRAW_COMMAND:
+ * One recorded draw, either a single primitive
+ * (vertices and attributes copied at record time)
+ * or a whole Mesh. 'key' orders commands by state
+ * in its high half and by depth in its low half.
+ * Uniforms and the recording thread's depth test
+ * (see RasterDepthTest) are copied at record time,
+ * so either may be changed between draws as usual.
+ * Anything they point to (e.g. textures) must stay
+ * alive and unchanged until the command is replayed.
+ * Replay is split in two: shade() runs the vertex
+ * shader once per vertex (once per mesh vertex, not
+ * per triangle corner), rasterize() draws from the
+ * shaded vertices and may run once per band or
+ * scissor rectangle.
+ ***************************************************/
+struct DrawCommand
+{
+    PRIMITIVES prim;
+    Vertex verts[3];
+    Attributes attrs[3];
+    Mesh* mesh;
+    const Attributes* vertAttrs;
+    mutable Attributes uniforms;    // Never modified, DrawPrimitive takes a non-const pointer
+    bool hasUniforms;
+    FragmentShader* frag;
+    VertexShader* vert;
+    Buffer2D<DEPTH>* zBuf;
+    DEPTH_TEST depthTest;
+    Uint64 key;
+
+    // Shaded vertices the command needs
+    int vertexCount() const
+    {
+        if(mesh != NULL)
+        {
+            return mesh->numVertices;
+        }
+        return (prim == TRIANGLE) ? 3 : (prim == LINE ? 2 : 1);
+    }
+
+    // Vertex shader over vertices [begin, end), written to the same indices of 'outVerts'/'outAttrs'
+    void shade(const int & begin, const int & end, Vertex* outVerts, Attributes* outAttrs) const
+    {
+        static const Attributes noAttrs[MAX_VERTICES];
+        const Vertex* srcVerts = (mesh != NULL) ? mesh->vertices : verts;
+        const Attributes* srcAttrs = (mesh != NULL) ? vertAttrs : attrs;
+        for(int i = begin; i < end; i += MAX_VERTICES)
+        {
+            int num = MIN(MAX_VERTICES, end - i);
+            VertexShaderExecuteVertices(vert, srcVerts + i, (srcAttrs != NULL) ? srcAttrs + i : noAttrs, num,
+                                        hasUniforms ? &uniforms : NULL, outVerts + i, outAttrs + i);
+        }
+    }
+
+    // Draw from vertexCount() shaded vertices with the recorded depth test
+    void rasterize(Buffer2D<PIXEL>& target, const Vertex* shadedVerts, const Attributes* shadedAttrs) const
+    {
+        DEPTH_TEST & test = RasterDepthTest();
+        DEPTH_TEST saved = test;
+        test = depthTest;
+        Attributes* unis = hasUniforms ? &uniforms : NULL;
+        if(mesh != NULL)
+        {
+            Vertex tri[3];
+            Attributes triAttrs[3];
+            for(int i = 0; i + 2 < mesh->numIndices; i += 3)
+            {
+                for(int k = 0; k < 3; k++)
+                {
+                    Uint32 index = mesh->indices[i + k];
+                    tri[k] = shadedVerts[index];
+                    triAttrs[k] = shadedAttrs[index];
+                }
+                DrawPrimitive(TRIANGLE, target, tri, triAttrs, unis, frag, NULL, zBuf);
+            }
+        }
+        else
+        {
+            DrawPrimitive(prim, target, shadedVerts, shadedAttrs, unis, frag, NULL, zBuf);
+        }
+        test = saved;
+    }
+};
+
+// Process wide stamp, unique for every state a buffer is ever in
+inline Uint64 NextCommandGeneration()
+{
+    static std::atomic<Uint64> generation(0);
+    return ++generation;
+}
+
+/****************************************************
+ * COMMAND_BUFFER:
+ * Cheap recording of draws for later submission.
+ * A buffer is recorded by one thread at a time, use
+ * one buffer per thread to record in parallel.
+ * Buffers keep their commands across submits, so a
+ * static buffer is recorded once and re-submitted
+ * every frame.
+ ***************************************************/
+class CommandBuffer
+{
+    protected:
+        std::vector<DrawCommand> commands;
+        Uint64 changes;
+
+        // State half of the sort key: shaders, texture and depth mode (buffer and test).
+        // The test is the top bits, so within a run DEPTH_LESS draws lay down depth
+        // before the LESS_EQUAL and EQUAL draws that test against it.
+        static Uint32 stateKey(const FragmentShader* frag, const VertexShader* vert, const void* texture,
+                               const Buffer2D<DEPTH>* zBuf, const DEPTH_TEST & test)
+        {
+            Uint64 state[4] = {(Uint64)(size_t)(frag != NULL ? (const void*)frag->FragShader : NULL),
+                               (Uint64)(size_t)(vert != NULL ? (vert->transform != NULL ? (const void*)vert->transform : (const void*)vert->VertShader) : NULL),
+                               (Uint64)(size_t)texture,
+                               (Uint64)(size_t)zBuf};
+            Uint64 hash = 0xcbf29ce484222325ull;
+            for(int i = 0; i < 4; i++)
+            {
+                hash = (hash ^ state[i]) * 0x100000001b3ull;
+                hash ^= hash >> 32;
+            }
+            return ((Uint32)test << 30) | ((Uint32)hash & 0x3fffffff);
+        }
+
+        // Depth half of the sort key, monotonic in 'z' for non-negative floats
+        static Uint32 depthKey(const float & z)
+        {
+            float clamped = (z > 0) ? z : 0;
+            Uint32 bits;
+            memcpy(&bits, &clamped, sizeof(bits));
+            return bits;
+        }
+
+        // Nearest vertex in clip space if the shader is a matrix, else as given
+        static float nearestZ(const Vertex* verts, const int & count, const VertexShader* vert)
+        {
+            float nearest = FLT_MAX;
+            for(int i = 0; i < count; i++)
+            {
+                float z = (float)verts[i].z;
+                if(vert != NULL && vert->transform != NULL)
+                {
+                    z = (float)((*vert->transform) * Vec4(verts[i])).z;
+                }
+                nearest = MIN(nearest, z);
+            }
+            return nearest;
+        }
+
+        // Nearest corner of the mesh's bounds, eight points however large the mesh
+        static float nearestZ(const Mesh & mesh, const VertexShader* vert)
+        {
+            Vertex corners[8];
+            for(int c = 0; c < 8; c++)
+            {
+                corners[c].x = (c & 1) ? mesh.boundsMax.x : mesh.boundsMin.x;
+                corners[c].y = (c & 2) ? mesh.boundsMax.y : mesh.boundsMin.y;
+                corners[c].z = (c & 4) ? mesh.boundsMax.z : mesh.boundsMin.z;
+                corners[c].w = 1;
+            }
+            return nearestZ(corners, (mesh.numVertices > 0) ? 8 : 0, vert);
+        }
+
+    public:
+        CommandBuffer()
+        {
+            changes = NextCommandGeneration();
+        }
+
+        // Forget all commands, ready to re-record
+        void reset()
+        {
+            commands.clear();
+            changes = NextCommandGeneration();
+        }
+
+        // Record a single primitive, 'texture' only groups draws sharing an image
+        void draw(PRIMITIVES prim,
+                  const Vertex inputVerts[],
+                  const Attributes inputAttrs[],
+                  Attributes* const uniforms = NULL,
+                  FragmentShader* const frag = NULL,
+                  VertexShader* const vert = NULL,
+                  Buffer2D<DEPTH>* zBuf = NULL,
+                  const void* texture = NULL)
+        {
+            DrawCommand cmd;
+            int count = (prim == TRIANGLE) ? 3 : (prim == LINE ? 2 : 1);
+            cmd.prim = prim;
+            for(int i = 0; i < count; i++)
+            {
+                cmd.verts[i] = inputVerts[i];
+                cmd.attrs[i] = inputAttrs[i];
+            }
+            cmd.mesh = NULL;
+            cmd.vertAttrs = NULL;
+            cmd.hasUniforms = (uniforms != NULL);
+            if(cmd.hasUniforms)
+            {
+                cmd.uniforms = *uniforms;
+            }
+            cmd.frag = frag;
+            cmd.vert = vert;
+            cmd.zBuf = zBuf;
+            cmd.depthTest = RasterDepthTest();
+            cmd.key = ((Uint64)stateKey(frag, vert, texture, zBuf, cmd.depthTest) << 32) | depthKey(nearestZ(inputVerts, count, vert));
+            commands.push_back(cmd);
+            changes = NextCommandGeneration();
+        }
+
+        // Record a whole mesh, sorted by the nearest corner of its bounds
+        void drawMesh(Mesh* mesh,
+                      const Attributes* vertAttrs = NULL,
+                      Attributes* const uniforms = NULL,
+                      FragmentShader* const frag = NULL,
+                      VertexShader* const vert = NULL,
+                      Buffer2D<DEPTH>* zBuf = NULL,
+                      const void* texture = NULL)
+        {
+            DrawCommand cmd;
+            cmd.prim = TRIANGLE;
+            cmd.mesh = mesh;
+            cmd.vertAttrs = vertAttrs;
+            cmd.hasUniforms = (uniforms != NULL);
+            if(cmd.hasUniforms)
+            {
+                cmd.uniforms = *uniforms;
+            }
+            cmd.frag = frag;
+            cmd.vert = vert;
+            cmd.zBuf = zBuf;
+            cmd.depthTest = RasterDepthTest();
+            cmd.key = ((Uint64)stateKey(frag, vert, texture, zBuf, cmd.depthTest) << 32) | depthKey(nearestZ(*mesh, vert));
+            commands.push_back(cmd);
+            changes = NextCommandGeneration();
+        }
+
+        int size() { return (int)commands.size(); }
+        const DrawCommand & operator[](const int & i) { return commands[i]; }
+        const Uint64 & version() { return changes; }
+};
+
+/****************************************************
+ * COMMAND_QUEUE:
+ * Submits command buffers to a render target. At
+ * submit the commands of all buffers are ordered by
+ * state then front-to-back, except that draws with
+ * no depth buffer keep their recorded position and
+ * act as barriers (painter's order). The ordering is
+ * cached while the same, unchanged buffers are
+ * re-submitted. Vertices are shaded once per submit,
+ * then with 'threads' > 1 each thread rasterizes
+ * every command into its own horizontal band of the
+ * target, both on the SharedWorkers, so shaders must
+ * be thread-safe. prepare() and rasterize() are the
+ * two halves of submit, to draw one prepared frame
+ * under several scissor rectangles.
+ ***************************************************/
+class CommandQueue
+{
+    protected:
+        std::vector<const DrawCommand*> order;
+        std::vector<CommandBuffer*> lastBuffers;
+        std::vector<Uint64> lastVersions;
+        std::vector<int> firstVertex;       // Per ordered command, plus the total
+        std::vector<Vertex> shadedVerts;
+        std::vector<Attributes> shadedAttrs;
+        Buffer2D<PIXEL>* bandTarget;        // Of the rasterize() in progress
+        Scissor bandBounds;
+        int bandHeight;
+
+        static bool keyLess(const DrawCommand* a, const DrawCommand* b)
+        {
+            return a->key < b->key;
+        }
+
+        bool unchanged(CommandBuffer* const buffers[], const int & count)
+        {
+            if((int)lastBuffers.size() != count)
+            {
+                return false;
+            }
+            for(int b = 0; b < count; b++)
+            {
+                if(lastBuffers[b] != buffers[b] || lastVersions[b] != buffers[b]->version())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void sortCommands(CommandBuffer* const buffers[], const int & count)
+        {
+            order.clear();
+            lastBuffers.assign(buffers, buffers + count);
+            lastVersions.resize(count);
+            for(int b = 0; b < count; b++)
+            {
+                lastVersions[b] = buffers[b]->version();
+                for(int i = 0; i < buffers[b]->size(); i++)
+                {
+                    order.push_back(&(*buffers[b])[i]);
+                }
+            }
+
+            // Sort each run of depth tested draws between barriers
+            size_t start = 0;
+            for(size_t i = 0; i <= order.size(); i++)
+            {
+                if(i == order.size() || order[i]->zBuf == NULL)
+                {
+                    std::sort(order.begin() + start, order.begin() + i, keyLess);
+                    start = i + 1;
+                }
+            }
+
+            // Where each command's shaded vertices go
+            firstVertex.resize(order.size() + 1);
+            firstVertex[0] = 0;
+            for(size_t i = 0; i < order.size(); i++)
+            {
+                firstVertex[i + 1] = firstVertex[i] + order[i]->vertexCount();
+            }
+        }
+
+        // Job part: shaded vertices [part * COMMAND_SHADE_CHUNK, ...) of whichever commands hold them
+        static void shadeChunk(void* context, const int & part)
+        {
+            TRACE_SCOPE("command vertex");
+            CommandQueue* queue = (CommandQueue*)context;
+            int begin = part * COMMAND_SHADE_CHUNK;
+            int end = MIN(begin + COMMAND_SHADE_CHUNK, queue->firstVertex.back());
+            size_t c = std::upper_bound(queue->firstVertex.begin(), queue->firstVertex.end(), begin) - queue->firstVertex.begin() - 1;
+            for(; c < queue->order.size() && queue->firstVertex[c] < end; c++)
+            {
+                int first = queue->firstVertex[c];
+                int from = MAX(begin, first) - first;
+                int to = MIN(end, queue->firstVertex[c + 1]) - first;
+                queue->order[c]->shade(from, to, &queue->shadedVerts[first], &queue->shadedAttrs[first]);
+            }
+        }
+
+        // Job part: every command into one band, within the caller's scissor
+        static void rasterizeBand(void* context, const int & part)
+        {
+            TRACE_SCOPE("replay band");
+            CommandQueue* queue = (CommandQueue*)context;
+            Scissor & scissor = RasterScissor();
+            Scissor saved = scissor;
+            scissor = queue->bandBounds;
+            scissor.minY = queue->bandBounds.minY + part * queue->bandHeight;
+            scissor.maxY = MIN(scissor.minY + queue->bandHeight - 1, queue->bandBounds.maxY);
+            if(scissor.minY <= scissor.maxY)
+            {
+                queue->drawAll(*queue->bandTarget);
+            }
+            scissor = saved;
+        }
+
+        void drawAll(Buffer2D<PIXEL>& target)
+        {
+            for(size_t i = 0; i < order.size(); i++)
+            {
+                int first = firstVertex[i];
+                order[i]->rasterize(target, &shadedVerts[first], &shadedAttrs[first]);
+            }
+        }
+
+    public:
+        CommandQueue()
+        {
+            bandTarget = NULL;
+            bandHeight = 0;
+        }
+
+        // Order the commands (if the buffers changed) and shade their vertices
+        void prepare(CommandBuffer* const buffers[], const int & count, int threads = 1)
+        {
+            if(!unchanged(buffers, count))
+            {
+                sortCommands(buffers, count);
+            }
+
+            // Scratch only grows, the steady state allocates nothing
+            int total = firstVertex.empty() ? 0 : firstVertex.back();
+            if((int)shadedVerts.size() < total)
+            {
+                shadedVerts.resize(total);
+                shadedAttrs.resize(total);
+            }
+            int chunks = (total + COMMAND_SHADE_CHUNK - 1) / COMMAND_SHADE_CHUNK;
+            if(MAX(1, threads) == 1)
+            {
+                for(int part = 0; part < chunks; part++)
+                {
+                    shadeChunk(this, part);
+                }
+                return;
+            }
+            SharedWorkers().run(shadeChunk, this, chunks);
+        }
+
+        // Draw the prepared commands within the caller's scissor, in bands when 'threads' > 1
+        void rasterize(Buffer2D<PIXEL>& target, int threads = 1)
+        {
+            const Scissor & outer = RasterScissor();
+            Scissor bounds;
+            bounds.enabled = true;
+            bounds.minX = outer.enabled ? MAX(outer.minX, 0) : 0;
+            bounds.maxX = outer.enabled ? MIN(outer.maxX, target.width() - 1) : target.width() - 1;
+            bounds.minY = outer.enabled ? MAX(outer.minY, 0) : 0;
+            bounds.maxY = outer.enabled ? MIN(outer.maxY, target.height() - 1) : target.height() - 1;
+            int rows = bounds.maxY - bounds.minY + 1;
+            threads = MAX(1, MIN(threads, rows));
+            if(threads == 1 || bounds.minX > bounds.maxX)
+            {
+                drawAll(target);
+                return;
+            }
+
+            // Bands split the rows of the scissored area evenly
+            bandTarget = &target;
+            bandBounds = bounds;
+            bandHeight = (rows + threads - 1) / threads;
+            SharedWorkers().run(rasterizeBand, this, threads);
+            bandTarget = NULL;
+        }
+
+        void submit(Buffer2D<PIXEL>& target, CommandBuffer* const buffers[], const int & count, int threads = 1)
+        {
+            prepare(buffers, count, threads);
+            rasterize(target, threads);
+        }
+
+        void submit(Buffer2D<PIXEL>& target, CommandBuffer & buffer, int threads = 1)
+        {
+            CommandBuffer* buffers[1] = {&buffer};
+            submit(target, buffers, 1, threads);
+        }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "definitions.h"
+#include "targetpool.h"
 
 #ifndef COURSE_FUNCTIONS_H
 #define COURSE_FUNCTIONS_H
@@ -9,7 +10,7 @@
  * comment out the following function calls in 
  * pipeline.cpp:main():
  *      1) processUserInputs(running);
- *      2) clearScreen(frame);
+ *      2) RenderDirtyRegions(frame, dirty, queue, frameCommands);
  *      3) Any draw calls that are being made there
  * 
  * When you finish this activity be sure to 
@@ -114,13 +115,20 @@ void GameOfLife(Buffer2D<PIXEL> & target)
  **************************************************/
 void CADView(Buffer2D<PIXEL> & target)
 {
-        // Each CAD Quadrant
-        static int halfWid = target.width()/2;
-        static int halfHgt = target.height()/2;
+        // Each CAD Quadrant, kept across frames (re-created if the target is resized)
+        int halfWid = target.width()/2;
+        int halfHgt = target.height()/2;
         static Buffer2D<PIXEL> topLeft(halfWid, halfHgt);
         static Buffer2D<PIXEL> topRight(halfWid, halfHgt);
         static Buffer2D<PIXEL> botLeft(halfWid, halfHgt);
         static Buffer2D<PIXEL> botRight(halfWid, halfHgt);
+        if(topLeft.width() != halfWid || topLeft.height() != halfHgt)
+        {
+                topLeft = Buffer2D<PIXEL>(halfWid, halfHgt);
+                topRight = Buffer2D<PIXEL>(halfWid, halfHgt);
+                botLeft = Buffer2D<PIXEL>(halfWid, halfHgt);
+                botRight = Buffer2D<PIXEL>(halfWid, halfHgt);
+        }
 
 
         // Your code goes here 
@@ -275,12 +283,14 @@ void TestDrawPerspectiveCorrect(Buffer2D<PIXEL> & target)
         * 1. Image quad (2 TRIs) Code (texture interpolated)
         **************************************************/
         // Artificially projected, viewport transformed
-        double divA = 6;
-        double divB = 40;
-        Vertex quad[] = {{(-1200 / divA) + (S_WIDTH/2), (-1500 / divA) + (S_HEIGHT/2), divA, 1.0/divA },
-                         {(1200  / divA) + (S_WIDTH/2), (-1500 / divA) + (S_HEIGHT/2), divA, 1.0/divA },
-                         {(1200  / divB) + (S_WIDTH/2), (1500  / divB) + (S_HEIGHT/2), divB, 1.0/divB },
-                         {(-1200 / divB) + (S_WIDTH/2), (1500  / divB) + (S_HEIGHT/2), divB, 1.0/divB }};
+        REAL divA = 6;
+        REAL divB = 40;
+        REAL halfW = target.width() / (REAL)2;
+        REAL halfH = target.height() / (REAL)2;
+        Vertex quad[] = {{(-1200 / divA) + halfW, (-1500 / divA) + halfH, divA, 1/divA },
+                         {(1200  / divA) + halfW, (-1500 / divA) + halfH, divA, 1/divA },
+                         {(1200  / divB) + halfW, (1500  / divB) + halfH, divB, 1/divB },
+                         {(-1200 / divB) + halfW, (1500  / divB) + halfH, divB, 1/divB }};
 
         Vertex verticesImgA[3];
         Attributes imageAttributesA[3];
@@ -390,7 +400,8 @@ void TestPipeline(Buffer2D<PIXEL> & target)
         //              vi)  camZ
         //      To incorporate a view transform (add movement)
         
-        static Buffer2D<double> zBuf(target.width(), target.height());
+        PooledTarget<DEPTH> zBufTarget(target.width(), target.height());
+        Buffer2D<DEPTH> & zBuf = *zBufTarget;
         // Will need to be cleared every frame, like the screen
 
         /**************************************************
@@ -3,6 +3,8 @@
 #include "stdlib.h"
 #include "stdio.h"
 #include "math.h"
+#include "float.h"
+#include "string.h"
 
 #ifndef DEFINITIONS_H
 #define DEFINITIONS_H
@@ -12,19 +14,45 @@
  * Macros for universal variables/hook-ups.
  *****************************************************/
 #define WINDOW_NAME "Pipeline"
-#define S_WIDTH     512
+#define S_WIDTH     512     // Default window size, see main()
 #define S_HEIGHT    512
 #define PIXEL       Uint32
-#define ABS(in) (in > 0 ? (in) : -(in))
+#define IDLE_WAIT_MS 100
+#define ABS(in) ((in) > 0 ? (in) : -(in))
 #define SWAP(TYPE, FIRST, SECOND) { TYPE tmp = FIRST; FIRST = SECOND; SECOND = tmp; }
-#define MIN(A,B) A < B ? A : B
-#define MAX(A,B) A > B ? A : B
-#define MIN3(A,B,C) MIN((MIN(A,B)),C)
-#define MAX3(A,B,C) MAX((MAX(A,B)),C)
+#define MIN(A,B) ((A) < (B) ? (A) : (B))
+#define MAX(A,B) ((A) > (B) ? (A) : (B))
+#define MIN3(A,B,C) MIN(MIN(A,B),C)
+#define MAX3(A,B,C) MAX(MAX(A,B),C)
 
 // Max # of vertices after clipping
 #define MAX_VERTICES 8 
 
+/******************************************************
+ * ALIGNED_MALLOC / ALIGNED_FREE:
+ * SIMD friendly allocations for sample and pixel
+ * storage. 'align' must be a power of two.
+ *****************************************************/
+inline void* alignedMalloc(size_t bytes, size_t align = 32)
+{
+    void* raw = malloc(bytes + align + sizeof(void*));
+    if(raw == NULL)
+    {
+        return NULL;
+    }
+    size_t addr = ((size_t)raw + sizeof(void*) + align - 1) & ~(align - 1);
+    ((void**)addr)[-1] = raw;
+    return (void*)addr;
+}
+
+inline void alignedFree(void* ptr)
+{
+    if(ptr != NULL)
+    {
+        free(((void**)ptr)[-1]);
+    }
+}
+
 /******************************************************
  * Types of primitives our pipeline will render.
  *****************************************************/
@@ -35,15 +63,71 @@ enum PRIMITIVES
     POINT
 };
 
+/******************************************************
+ * PRECISION:
+ * REAL is the scalar type of the geometry pipeline.
+ * Single precision is the fast path, define 
+ * PIPELINE_DOUBLE to validate against double. DEPTH 
+ * is the z-buffer format, REAL by default or a 24-bit
+ * unsigned normalized value with DEPTH_UNORM24.
+ * Precision is chosen per build: only TVertex and
+ * TTriangleSetup are templates, the stages that use
+ * them (shaders, DrawTriangle, depth pass, MSAA,
+ * Matrix4) are written against Vertex, REAL and DEPTH.
+ *****************************************************/
+#ifdef PIPELINE_DOUBLE
+#define REAL double
+#else
+#define REAL float
+#endif
+
+#ifdef DEPTH_UNORM24
+#define DEPTH DepthUnorm24
+#else
+#define DEPTH REAL
+#endif
+
 /****************************************************
- * Describes a geometric point in 3D space. 
+ * Describes a geometric point in 3D space, templated
+ * on its scalar type.
  ****************************************************/
-struct Vertex
+template <class T>
+struct TVertex
 {
-    double x;
-    double y;
-    double z;
-    double w;
+    T x;
+    T y;
+    T z;
+    T w;
+};
+typedef TVertex<REAL> Vertex;
+
+/****************************************************
+ * DEPTH_UNORM24:
+ * Compact depth value, [0,1] mapped onto 24 bits.
+ * Values outside that range are clamped, so clear 
+ * to 1.0 and feed normalized depth.
+ ***************************************************/
+struct DepthUnorm24
+{
+    Uint32 bits;
+
+    DepthUnorm24() {}
+
+    DepthUnorm24(const double & value)
+    {
+        double clamped = value < 0 ? 0 : (value > 1 ? 1 : value);
+        bits = (Uint32)(clamped * 0xffffff + 0.5);
+    }
+
+    operator REAL() const
+    {
+        return (REAL)(bits * (1.0 / 0xffffff));
+    }
+
+    bool operator<(const DepthUnorm24 & rhs) const
+    {
+        return bits < rhs.bits;
+    }
 };
 
 /******************************************************
@@ -57,34 +141,68 @@ class Buffer2D
 {
     protected:
         T** grid;
+        T* data;        // Owned storage, NULL when rows point elsewhere
         int w;
         int h;
 
         // Private intialization setup
         void setupInternal()
         {
-            // Allocate pointers for column references
+            // One aligned block, row pointers into it
             grid = (T**)malloc(sizeof(T*) * h);                
+            data = (T*)alignedMalloc(sizeof(T) * w * h);
+            for(int r = 0; r < h; r++)
+            {
+                grid[r] = data + r * w;
+            }
+        }
+
+        // Release storage, leaves an empty buffer
+        void freeInternal()
+        {
+            alignedFree(data);
+            free(grid);
+            grid = NULL;
+            data = NULL;
+            w = 0;
+            h = 0;
+        }
+
+        // Take over another buffer's storage
+        void stealInternal(Buffer2D & ib)
+        {
+            grid = ib.grid;
+            data = ib.data;
+            w = ib.w;
+            h = ib.h;
+            ib.grid = NULL;
+            ib.data = NULL;
+            ib.w = 0;
+            ib.h = 0;
+        }
+
+        void copyRows(const Buffer2D & ib)
+        {
             for(int r = 0; r < h; r++)
             {
-                grid[r] = (T*)malloc(sizeof(T) * w);
+                memcpy(grid[r], ib.grid[r], sizeof(T) * w);
             }
         }
 
         // Empty Constructor
         Buffer2D()
-        {}
+        {
+            grid = NULL;
+            data = NULL;
+            w = 0;
+            h = 0;
+        }
 
     public:
         // Free dynamic memory
         ~Buffer2D()
         {
-            // De-Allocate pointers for column references
-            for(int r = 0; r < h; r++)
-            {
-                free(grid[r]);
-            }
-            free(grid);
+            freeInternal();
         }
 
         // Size-Specified constructor, no data
@@ -96,19 +214,49 @@ class Buffer2D
             zeroOut();
         }
 
-        // Assignment constructor
-        Buffer2D& operator=(const Buffer2D & ib)
+        // Copy constructor
+        Buffer2D(const Buffer2D & ib)
         {
             w = ib.width();
             h = ib.height();
             setupInternal();
-            for(int r = 0; r < h; r++)
+            copyRows(ib);
+        }
+
+        // Move constructor
+        Buffer2D(Buffer2D && ib)
+        {
+            stealInternal(ib);
+        }
+
+        // Assignment constructor, rows are copied in place when the size matches
+        // (so a BufferImage stays attached to its surface)
+        Buffer2D& operator=(const Buffer2D & ib)
+        {
+            if(this == &ib)
             {
-                for(int c = 0; c < w; c++)
-                {
-                    grid[r][c] = ib[r][c];
-                }
+                return *this;
+            }
+            if(grid == NULL || w != ib.width() || h != ib.height())
+            {
+                freeInternal();
+                w = ib.width();
+                h = ib.height();
+                setupInternal();
+            }
+            copyRows(ib);
+            return *this;
+        }
+
+        // Move assignment
+        Buffer2D& operator=(Buffer2D && ib)
+        {
+            if(this != &ib)
+            {
+                freeInternal();
+                stealInternal(ib);
             }
+            return *this;
         }
 
         // Set each member to zero 
@@ -124,21 +272,27 @@ class Buffer2D
         }
 
         // Width, height
-        const int & width()  { return w; }
-        const int & height() { return h; }
+        const int & width() const  { return w; }
+        const int & height() const { return h; }
 
         // The frequented operator for grabbing pixels
         inline T* & operator[] (int i)
         {
             return grid[i];
         }
+
+        inline const T* operator[] (int i) const
+        {
+            return grid[i];
+        }
 };
 
 
 /****************************************************
  * BUFFER_IMAGE:
  * PIXEL (Uint32) specific Buffer2D class with .BMP 
- * loading/management features.
+ * loading/management features. Copies own a private
+ * copy of the surface, moves take it over.
  ***************************************************/
 class BufferImage : public Buffer2D<PIXEL>
 {
@@ -152,10 +306,11 @@ class BufferImage : public Buffer2D<PIXEL>
             // Allocate pointers for column references
             h = img->h;
             w = img->w;
+            data = NULL;
             grid = (PIXEL**)malloc(sizeof(PIXEL*) * h);                
 
             PIXEL* row = (PIXEL*)img->pixels;
-            row += (w*h);
+            row += (w*(h-1));
             for(int i = 0; i < h; i++)
             {
                 grid[i] = row;
@@ -163,32 +318,78 @@ class BufferImage : public Buffer2D<PIXEL>
             }
         }
 
+        // Drop the surface (if ours) and row pointers
+        void freeImage()
+        {
+            if(ourSurfaceInstance)
+            {
+                SDL_FreeSurface(img);
+            }
+            img = NULL;
+            ourSurfaceInstance = false;
+            freeInternal();
+        }
+
+        // Private deep copy of another image's surface
+        void copyImage(const BufferImage & ib)
+        {
+            img = SDL_ConvertSurface(ib.img, ib.img->format, 0);
+            ourSurfaceInstance = true;
+            setupInternal();
+        }
+
+        void stealImage(BufferImage & ib)
+        {
+            img = ib.img;
+            ourSurfaceInstance = ib.ourSurfaceInstance;
+            stealInternal(ib);
+            ib.img = NULL;
+            ib.ourSurfaceInstance = false;
+        }
+
     public:
         // Free dynamic memory
         ~BufferImage()
         {
-            // De-Allocate pointers for column references
-            free(grid);
-
-            // De-Allocate this image plane if necessary
+            // De-Allocate this image plane if necessary, rows go with Buffer2D
             if(ourSurfaceInstance)
             {
                 SDL_FreeSurface(img);
             }
         }
 
+        // Copy constructor
+        BufferImage(const BufferImage & ib) : Buffer2D<PIXEL>()
+        {
+            copyImage(ib);
+        }
+
+        // Move constructor
+        BufferImage(BufferImage && ib) : Buffer2D<PIXEL>()
+        {
+            stealImage(ib);
+        }
+
         // Assignment constructor
         BufferImage& operator=(const BufferImage & ib)
         {
-            img = ib.img;
-            w = ib.w;
-            h = ib.h;
-            ourSurfaceInstance = false;
-            grid = (PIXEL**)malloc(sizeof(PIXEL*) * img->h);                
-            for(int i = 0; i < img->w; i++)
+            if(this != &ib)
             {
-                grid[i] = ib.grid[i];
+                freeImage();
+                copyImage(ib);
             }
+            return *this;
+        }
+
+        // Move assignment
+        BufferImage& operator=(BufferImage && ib)
+        {
+            if(this != &ib)
+            {
+                freeImage();
+                stealImage(ib);
+            }
+            return *this;
         }
 
         // Constructor based on instantiated SDL_Surface
@@ -233,6 +434,19 @@ class Attributes
         }
 };	
 
+/***************************************************
+ * INTERPOLATE_ATTRIBUTES
+ * Barycentric blend of three per-vertex Attributes
+ * built from the two-way clipping constructor, so
+ * rasterizers need no knowledge of their contents.
+ **************************************************/
+inline Attributes InterpolateAttributes(const Attributes* const attrs, const double & l0, const double & l1, const double & l2)
+{
+    double l01 = l0 + l1;
+    Attributes edge = (l01 > 0) ? Attributes(attrs[0], attrs[1], l1 / l01) : attrs[0];
+    return Attributes(edge, attrs[2], l2);
+}
+
 // Example of a fragment shader
 void DefaultFragShader(PIXEL & fragment, const Attributes & vertAttr, const Attributes & uniforms)
 {
@@ -280,23 +494,29 @@ void DefaultVertShader(Vertex & vertOut, Attributes & attrOut, const Vertex & ve
     attrOut = vertAttr;
 }
 
+class Matrix4;
+
 /**********************************************************
  * VERTEX_SHADER
  * Encapsulates a programmer-specified callback
  * function for transforming vertices and per-vertex
  * attributes. See 'DefaultVertShader' for a pass-through
- * shader example.
+ * shader example. A shader built from a Matrix4 instead
+ * runs the batched transform kernel (see matrix.h) and
+ * passes attributes through.
  *********************************************************/
 class VertexShader
 {
     public:
         // Get, Set implicit
         void (*VertShader)(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr, const Attributes & uniforms);
+        const Matrix4* transform;
 
         // Assumes simple monotone RED shader
         VertexShader()
         {
             VertShader = DefaultVertShader;
+            transform = NULL;
         }
 
         // Initialize with a fragment callback
@@ -305,10 +525,24 @@ class VertexShader
             setShader(VertSdr);
         }
 
+        // Initialize with a matrix applied to every position
+        VertexShader(const Matrix4* mat)
+        {
+            setTransform(mat);
+        }
+
         // Set the shader to a callback function
         void setShader(void (*VertSdr)(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr, const Attributes & uniforms))
         {
             VertShader = VertSdr;
+            transform = NULL;
+        }
+
+        // Set the shader to a matrix transform, the matrix must outlive the draw calls
+        void setTransform(const Matrix4* mat)
+        {
+            VertShader = DefaultVertShader;
+            transform = mat;
         }
 };
 
@@ -324,6 +558,14 @@ void DrawPrimitive(PRIMITIVES prim,
                    Attributes* const uniforms = NULL,
                    FragmentShader* const frag = NULL,
                    VertexShader* const vert = NULL,
-                   Buffer2D<double>* zBuf = NULL);             
+                   Buffer2D<DEPTH>* zBuf = NULL);             
+
+/****************************************
+ * VERTEX_SHADER_EXECUTE_VERTICES
+ * Prototype for the vertex stage shared
+ * by the drawing paths.
+ ***************************************/
+void VertexShaderExecuteVertices(const VertexShader* vert, Vertex const inputVerts[], Attributes const inputAttrs[], const int& numIn, 
+                                 Attributes* const uniforms, Vertex transformedVerts[], Attributes transformedAttrs[]);
        
 #endif
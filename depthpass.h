@@ -0,0 +1,154 @@
+#include "definitions.h"
+#include "rasterizer.h"
+#include "matrix.h"
+#include "mesh.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef DEPTH_PASS_H
+#define DEPTH_PASS_H
+
+/*************************************************************
+ * DRAW_TRIANGLE_DEPTH
+ * Depth-only rasterization for Z-prepasses and shadow maps.
+ * No attribute interpolation and no fragment shader, each
+ * covered pixel keeps the minimum of its stored and new
+ * depth. Coverage and depth are evaluated exactly as in
+ * DrawTriangle, so a later shading pass with the
+ * DEPTH_LESS_EQUAL or DEPTH_EQUAL test shades the pixels
+ * left here. Four pixels per step with SSE for float depth.
+ ************************************************************/
+void DrawTriangleDepth(Buffer2D<DEPTH> & depth, const Vertex* const triangle)
+{
+    TriangleSetup tri;
+    if(!tri.setup(triangle, depth.width(), depth.height()))
+    {
+        return;
+    }
+
+    for(int y = tri.minY; y <= tri.maxY; y++)
+    {
+        REAL py = y + (REAL)0.5;
+        REAL zRowValue = tri.depthRow(py);
+        DEPTH* row = depth[y];
+        int x = tri.minX;
+#if defined(__SSE2__) && !defined(PIPELINE_DOUBLE) && !defined(DEPTH_UNORM24)
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 edgeA[3];
+        __m128 edgeRow[3];
+        __m128 edgeZero[3];
+        const __m128 zero = _mm_setzero_ps();
+        for(int i = 0; i < 3; i++)
+        {
+            edgeA[i] = _mm_set1_ps(tri.A[i]);
+            edgeRow[i] = _mm_set1_ps(tri.B[i] * py + tri.C[i]);
+
+            // Top-left edges also accept zero, same rule as TriangleSetup::covers
+            edgeZero[i] = _mm_castsi128_ps(_mm_set1_epi32(tri.topLeft[i] ? -1 : 0));
+        }
+        __m128 zStep = _mm_set1_ps(tri.zA);
+        __m128 zRow = _mm_set1_ps(zRowValue);
+        for(; x + 4 <= tri.maxX + 1; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for(int i = 0; i < 3; i++)
+            {
+                __m128 e = _mm_add_ps(_mm_mul_ps(edgeA[i], px), edgeRow[i]);
+                __m128 edgeIn = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), edgeZero[i]));
+                inside = _mm_and_ps(inside, edgeIn);
+            }
+            if(_mm_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(zStep, px), zRow);
+            __m128 stored = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_min_ps(stored, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+        }
+#endif
+        for(; x <= tri.maxX; x++)
+        {
+            REAL e[3];
+            tri.evaluate(e, x + (REAL)0.5, py);
+            if(!tri.covers(e))
+            {
+                continue;
+            }
+            DEPTH z = tri.depth(x + (REAL)0.5, zRowValue);
+            if(z < row[x])
+            {
+                row[x] = z;
+            }
+        }
+    }
+}
+
+/***************************************************************************
+ * DRAW_PRIMITIVE_DEPTH
+ * Depth-only counterpart of DrawPrimitive, triangles only. The target's
+ * own size is the resolution. With a 'viewport' matrix (see
+ * Matrix4::viewport) shaded vertices are treated as clip coordinates:
+ * divided by w, then mapped to the target. Without one they are taken to
+ * be in the target's pixel space already.
+ **************************************************************************/
+void DrawPrimitiveDepth(PRIMITIVES prim,
+                        Buffer2D<DEPTH>& depth,
+                        const Vertex inputVerts[],
+                        VertexShader* const vert = NULL,
+                        Attributes* const uniforms = NULL,
+                        const Matrix4* viewport = NULL)
+{
+    if(prim != TRIANGLE)
+    {
+        return;
+    }
+
+    // Vertex shader, attributes are never read
+    Attributes noAttrs[MAX_VERTICES];
+    Vertex transformedVerts[MAX_VERTICES];
+    Attributes transformedAttrs[MAX_VERTICES];
+    VertexShaderExecuteVertices(vert, inputVerts, noAttrs, 3, uniforms, transformedVerts, transformedAttrs);
+
+    // Normalization and the pass's own viewport
+    if(viewport != NULL)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            Vertex & v = transformedVerts[i];
+            if(v.w <= 0)
+            {
+                return;
+            }
+            Vec4 ndc(v.x / v.w, v.y / v.w, v.z / v.w, 1);
+            v = (Vertex)((*viewport) * ndc);
+        }
+    }
+
+    DrawTriangleDepth(depth, transformedVerts);
+}
+
+/****************************************************
+ * DRAW_MESH_DEPTH
+ * Every triangle of 'mesh' through the depth-only
+ * path.
+ ***************************************************/
+void DrawMeshDepth(Buffer2D<DEPTH>& depth,
+                   Mesh & mesh,
+                   VertexShader* const vert = NULL,
+                   Attributes* const uniforms = NULL,
+                   const Matrix4* viewport = NULL)
+{
+    Vertex tri[3];
+    for(int i = 0; i + 2 < mesh.numIndices; i += 3)
+    {
+        tri[0] = mesh.vertices[mesh.indices[i]];
+        tri[1] = mesh.vertices[mesh.indices[i + 1]];
+        tri[2] = mesh.vertices[mesh.indices[i + 2]];
+        DrawPrimitiveDepth(TRIANGLE, depth, tri, vert, uniforms, viewport);
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include "definitions.h"
+#include "rasterizer.h"
+#include "matrix.h"
+#include "scene.h"
+#include "commandbuffer.h"
+#include <vector>
+
+#ifndef DIRTY_REGION_H
+#define DIRTY_REGION_H
+
+/******************************************************
+ * DEFINES:
+ * Dirty tracking granularity in pixels, and how many
+ * separate rectangles are redrawn before falling back
+ * to their common bounding rectangle.
+ *****************************************************/
+#define DIRTY_TILE      32
+#define DIRTY_MAX_RECTS 8
+
+/****************************************************
+ * DIRTY_TRACKER:
+ * Per-tile record of which parts of a render target
+ * must be redrawn. Rectangles are inclusive pixel
+ * ranges in buffer coordinates (row 0 is Buffer2D
+ * row 0).
+ ***************************************************/
+class DirtyTracker
+{
+    protected:
+        std::vector<bool> tiles;
+        std::vector<SDL_Rect> rects;
+        int w;
+        int h;
+        int tilesX;
+        int tilesY;
+        int count;
+
+    public:
+        DirtyTracker(const int & wid, const int & hgt)
+        {
+            w = wid;
+            h = hgt;
+            tilesX = (w + DIRTY_TILE - 1) / DIRTY_TILE;
+            tilesY = (h + DIRTY_TILE - 1) / DIRTY_TILE;
+            tiles.assign(tilesX * tilesY, false);
+            count = 0;
+        }
+
+        bool any() { return count > 0; }
+
+        void clear()
+        {
+            tiles.assign(tilesX * tilesY, false);
+            count = 0;
+        }
+
+        void markAll()
+        {
+            tiles.assign(tilesX * tilesY, true);
+            count = tilesX * tilesY;
+        }
+
+        void markRect(int minX, int minY, int maxX, int maxY)
+        {
+            minX = MAX(minX, 0);
+            minY = MAX(minY, 0);
+            maxX = MIN(maxX, w - 1);
+            maxY = MIN(maxY, h - 1);
+            for(int ty = minY / DIRTY_TILE; minY <= maxY && ty <= maxY / DIRTY_TILE; ty++)
+            {
+                for(int tx = minX / DIRTY_TILE; minX <= maxX && tx <= maxX / DIRTY_TILE; tx++)
+                {
+                    if(!tiles[ty * tilesX + tx])
+                    {
+                        tiles[ty * tilesX + tx] = true;
+                        count++;
+                    }
+                }
+            }
+        }
+
+        // Screen footprint of world space bounds, 'toScreen' is viewport * projection * view
+        void markBounds(const AABB & box, const Matrix4 & toScreen)
+        {
+            if(box.empty())
+            {
+                return;
+            }
+            REAL minX = FLT_MAX;
+            REAL minY = FLT_MAX;
+            REAL maxX = -FLT_MAX;
+            REAL maxY = -FLT_MAX;
+            for(int c = 0; c < 8; c++)
+            {
+                Vec4 corner((c & 1) ? box.hi.x : box.lo.x, (c & 2) ? box.hi.y : box.lo.y, (c & 4) ? box.hi.z : box.lo.z);
+                Vec4 p = toScreen * corner;
+                REAL sx = p.x / p.w;
+                REAL sy = p.y / p.w;
+                if(!(p.w > 0) || !(fabs(sx) <= FLT_MAX) || !(fabs(sy) <= FLT_MAX))
+                {
+                    // Straddles the camera plane (or degenerate), footprint is unbounded
+                    markAll();
+                    return;
+                }
+                minX = MIN(minX, sx);
+                minY = MIN(minY, sy);
+                maxX = MAX(maxX, sx);
+                maxY = MAX(maxY, sy);
+            }
+
+            // Clamp to just outside the target so the int conversion is defined
+            minX = MIN(MAX(minX, (REAL)-1), (REAL)w);
+            minY = MIN(MAX(minY, (REAL)-1), (REAL)h);
+            maxX = MIN(MAX(maxX, (REAL)-1), (REAL)w);
+            maxY = MIN(MAX(maxY, (REAL)-1), (REAL)h);
+            markRect((int)floor(minX), (int)floor(minY), (int)ceil(maxX), (int)ceil(maxY));
+        }
+
+        // Call before and after moving an object so both footprints are redrawn
+        void markObject(const SceneObject & obj, const Matrix4 & toScreen)
+        {
+            markBounds(obj.worldBounds, toScreen);
+        }
+
+        /*****************************************************
+         * Dirty tiles merged into rectangles: horizontal runs
+         * per tile row, extended downwards while the run
+         * below matches. Beyond DIRTY_MAX_RECTS the common
+         * bounding rectangle is returned instead.
+         ****************************************************/
+        const std::vector<SDL_Rect> & dirtyRects()
+        {
+            rects.clear();
+            std::vector<bool> used(tiles.size(), false);
+            for(int ty = 0; ty < tilesY; ty++)
+            {
+                for(int tx = 0; tx < tilesX; tx++)
+                {
+                    if(!tiles[ty * tilesX + tx] || used[ty * tilesX + tx])
+                    {
+                        continue;
+                    }
+                    int endX = tx;
+                    while(endX + 1 < tilesX && tiles[ty * tilesX + endX + 1] && !used[ty * tilesX + endX + 1])
+                    {
+                        endX++;
+                    }
+                    int endY = ty;
+                    bool grow = true;
+                    while(grow && endY + 1 < tilesY)
+                    {
+                        for(int x = tx; x <= endX && grow; x++)
+                        {
+                            grow = tiles[(endY + 1) * tilesX + x] && !used[(endY + 1) * tilesX + x];
+                        }
+                        if(grow)
+                        {
+                            endY++;
+                        }
+                    }
+                    for(int y = ty; y <= endY; y++)
+                    {
+                        for(int x = tx; x <= endX; x++)
+                        {
+                            used[y * tilesX + x] = true;
+                        }
+                    }
+                    SDL_Rect r;
+                    r.x = tx * DIRTY_TILE;
+                    r.y = ty * DIRTY_TILE;
+                    r.w = MIN((endX + 1) * DIRTY_TILE, w) - r.x;
+                    r.h = MIN((endY + 1) * DIRTY_TILE, h) - r.y;
+                    rects.push_back(r);
+                }
+            }
+
+            if(rects.size() > DIRTY_MAX_RECTS)
+            {
+                SDL_Rect bounds = rects[0];
+                for(size_t i = 1; i < rects.size(); i++)
+                {
+                    int right = MAX(bounds.x + bounds.w, rects[i].x + rects[i].w);
+                    int bottom = MAX(bounds.y + bounds.h, rects[i].y + rects[i].h);
+                    bounds.x = MIN(bounds.x, rects[i].x);
+                    bounds.y = MIN(bounds.y, rects[i].y);
+                    bounds.w = right - bounds.x;
+                    bounds.h = bottom - bounds.y;
+                }
+                rects.assign(1, bounds);
+            }
+            return rects;
+        }
+};
+
+/****************************************************
+ * RENDER_DIRTY_REGIONS
+ * Clears and redraws only the dirty rectangles of
+ * 'target' (and 'zBuf' if given). 'buffers' hold the
+ * whole frame's draws, recorded once: their vertices
+ * are shaded once, then the rasterizer scissor
+ * confines the replay to each rectangle in turn.
+ ***************************************************/
+void RenderDirtyRegions(Buffer2D<PIXEL> & target,
+                        DirtyTracker & dirty,
+                        CommandQueue & queue,
+                        CommandBuffer* const buffers[],
+                        const int & count,
+                        Buffer2D<DEPTH>* zBuf = NULL,
+                        PIXEL clearColor = 0xff000000,
+                        DEPTH clearDepth = FLT_MAX,
+                        int threads = 1)
+{
+    const std::vector<SDL_Rect> & rects = dirty.dirtyRects();
+    queue.prepare(buffers, count, threads);
+    Scissor & scissor = RasterScissor();
+    Scissor saved = scissor;
+    for(size_t i = 0; i < rects.size(); i++)
+    {
+        const SDL_Rect & r = rects[i];
+        for(int y = r.y; y < r.y + r.h; y++)
+        {
+            for(int x = r.x; x < r.x + r.w; x++)
+            {
+                target[y][x] = clearColor;
+                if(zBuf != NULL)
+                {
+                    (*zBuf)[y][x] = clearDepth;
+                }
+            }
+        }
+        scissor.enabled = true;
+        scissor.minX = r.x;
+        scissor.minY = r.y;
+        scissor.maxX = r.x + r.w - 1;
+        scissor.maxY = r.y + r.h - 1;
+        queue.rasterize(target, threads);
+    }
+    scissor = saved;
+}
+
+void RenderDirtyRegions(Buffer2D<PIXEL> & target,
+                        DirtyTracker & dirty,
+                        CommandQueue & queue,
+                        CommandBuffer & buffer,
+                        Buffer2D<DEPTH>* zBuf = NULL,
+                        PIXEL clearColor = 0xff000000,
+                        DEPTH clearDepth = FLT_MAX,
+                        int threads = 1)
+{
+    CommandBuffer* buffers[1] = {&buffer};
+    RenderDirtyRegions(target, dirty, queue, buffers, 1, zBuf, clearColor, clearDepth, threads);
+}
+
+#endif
@@ -0,0 +1,403 @@
+#include "definitions.h"
+#include "rasterizer.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "trace.h"
+#include "workerpool.h"
+#include <vector>
+
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+/******************************************************
+ * DEFINES:
+ * Upper bound on shaded vertices held at once, the
+ * instances of a draw are processed in batches that
+ * fit (at least one instance per batch).
+ *****************************************************/
+#define INSTANCE_BATCH_VERTICES 65536
+
+// Example of an instanced vertex shader
+void DefaultInstanceShader(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr,
+                           const Attributes & instance, const int & instanceID)
+{
+    // Nothing happens with this vertex, attribute
+    vertOut = vertIn;
+    attrOut = vertAttr;
+}
+
+/**********************************************************
+ * INSTANCED_VERTEX_SHADER
+ * Vertex shader for instanced draws. The callback also
+ * receives the instance's attributes and its index in
+ * the InstanceStream. A shader built from a Matrix4
+ * instead runs the batched transform kernel with the
+ * matrix applied after the instance transform.
+ *********************************************************/
+class InstancedVertexShader
+{
+    public:
+        // Get, Set implicit
+        void (*InstShader)(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr,
+                           const Attributes & instance, const int & instanceID);
+        const Matrix4* transform;
+
+        // Pass-through shader
+        InstancedVertexShader()
+        {
+            InstShader = DefaultInstanceShader;
+            transform = NULL;
+        }
+
+        // Initialize with a vertex callback
+        InstancedVertexShader(void (*InstSdr)(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr,
+                                              const Attributes & instance, const int & instanceID))
+        {
+            setShader(InstSdr);
+        }
+
+        // Initialize with a matrix shared by all instances (e.g. viewport * projection * view)
+        InstancedVertexShader(const Matrix4* mat)
+        {
+            setTransform(mat);
+        }
+
+        void setShader(void (*InstSdr)(Vertex & vertOut, Attributes & attrOut, const Vertex & vertIn, const Attributes & vertAttr,
+                                       const Attributes & instance, const int & instanceID))
+        {
+            InstShader = InstSdr;
+            transform = NULL;
+        }
+
+        // The matrix must outlive the draw calls
+        void setTransform(const Matrix4* mat)
+        {
+            InstShader = DefaultInstanceShader;
+            transform = mat;
+        }
+};
+
+/****************************************************
+ * INSTANCE_STREAM:
+ * Per-instance data of an instanced draw, 'count'
+ * entries in each array given. 'transforms' are
+ * model matrices applied to the mesh positions
+ * before the vertex shader, 'attrs' are handed to
+ * the vertex callback and are the uniforms of the
+ * instance's fragments. Either may be NULL.
+ ***************************************************/
+struct InstanceStream
+{
+    int count;
+    const Matrix4* transforms;
+    Attributes* attrs;
+
+    InstanceStream(const int & num, const Matrix4* models = NULL, Attributes* instAttrs = NULL)
+    {
+        count = num;
+        transforms = models;
+        attrs = instAttrs;
+    }
+};
+
+/****************************************************
+ * INSTANCE_SCRATCH:
+ * Grow-only buffers of one thread's instanced draws,
+ * kept across calls so the steady state allocates
+ * nothing. The drawing thread holds the shaded
+ * batch, every thread that shades instances its own
+ * transformed positions.
+ ***************************************************/
+struct InstanceScratch
+{
+    VertexArraySoA positions;           // Mesh positions of the draw
+    VertexArraySoA transformed;         // Of the instance being shaded
+    std::vector<Vertex> verts;
+    std::vector<Attributes> attrs;
+
+    InstanceScratch() : positions(0), transformed(0) {}
+};
+
+inline InstanceScratch & ThreadInstanceScratch()
+{
+    static thread_local InstanceScratch scratch;
+    return scratch;
+}
+
+/****************************************************
+ * INSTANCE_BATCH:
+ * Shaded vertices and attributes of a run of
+ * instances, 'numVertices' entries per instance in
+ * mesh vertex order. Each mesh vertex is shaded
+ * once per instance no matter how many triangles
+ * share it. Threaded passes run on SharedWorkers.
+ ***************************************************/
+class InstanceBatch
+{
+    protected:
+        Mesh* mesh;
+        const InstanceStream* stream;
+        const Attributes* vertAttrs;
+        Attributes* uniforms;
+        InstancedVertexShader* vert;
+        VertexArraySoA* positions;
+        int first;
+        int count;
+        std::vector<Vertex> & verts;
+        std::vector<Attributes> & attrs;
+
+        // Of the pass in progress
+        int parts;
+        Buffer2D<PIXEL>* bandTarget;
+        FragmentShader* bandFrag;
+        Buffer2D<DEPTH>* bandZBuf;
+        Scissor bandBounds;
+        int bandHeight;
+        DEPTH_TEST depthTest;
+
+        InstanceBatch(const InstanceBatch &);
+        InstanceBatch& operator=(const InstanceBatch &);
+
+        const Attributes & instanceAttrs(const int & instance) const
+        {
+            static const Attributes noUniforms;
+            if(stream->attrs != NULL)
+            {
+                return stream->attrs[instance];
+            }
+            return (uniforms != NULL) ? *uniforms : noUniforms;
+        }
+
+        // Vertex stage of instances [begin, end) of the batch
+        void shadeRange(const int & begin, const int & end)
+        {
+            TRACE_SCOPE("instance vertex");
+            static const Attributes noAttrs;
+            int n = mesh->numVertices;
+            bool kernel = (vert == NULL || vert->transform != NULL);
+            VertexArraySoA* out = NULL;
+            if(positions != NULL)
+            {
+                out = &ThreadInstanceScratch().transformed;
+                out->resize(n);
+            }
+            for(int b = begin; b < end; b++)
+            {
+                int instance = first + b;
+                Vertex* dstVerts = &verts[b * n];
+                Attributes* dstAttrs = &attrs[b * n];
+
+                // Model then shared matrix, concatenated into one kernel pass
+                if(out != NULL)
+                {
+                    Matrix4 mat;
+                    if(vert != NULL && vert->transform != NULL)
+                    {
+                        mat = *vert->transform;
+                    }
+                    if(stream->transforms != NULL)
+                    {
+                        mat = mat * stream->transforms[instance];
+                    }
+                    positions->transform(mat, *out);
+                    for(int i = 0; i < n; i++)
+                    {
+                        dstVerts[i] = out->get(i);
+                    }
+                }
+                else
+                {
+                    for(int i = 0; i < n; i++)
+                    {
+                        dstVerts[i] = mesh->vertices[i];
+                    }
+                }
+
+                if(kernel)
+                {
+                    for(int i = 0; i < n; i++)
+                    {
+                        dstAttrs[i] = (vertAttrs != NULL) ? vertAttrs[i] : noAttrs;
+                    }
+                    continue;
+                }
+
+                // Programmer callback on the model transformed vertices
+                const Attributes & inst = instanceAttrs(instance);
+                for(int i = 0; i < n; i++)
+                {
+                    Vertex in = dstVerts[i];
+                    vert->InstShader(dstVerts[i], dstAttrs[i], in, (vertAttrs != NULL) ? vertAttrs[i] : noAttrs, inst, instance);
+                }
+            }
+        }
+
+        // Rasterize every shaded instance, in instance then index order
+        void drawRange(Buffer2D<PIXEL>* target, FragmentShader* frag, Buffer2D<DEPTH>* zBuf)
+        {
+            int n = mesh->numVertices;
+            Vertex tri[3];
+            Attributes triAttrs[3];
+            for(int b = 0; b < count; b++)
+            {
+                int instance = first + b;
+                Attributes* unis = (stream->attrs != NULL) ? &stream->attrs[instance] : uniforms;
+                const Vertex* srcVerts = &verts[b * n];
+                const Attributes* srcAttrs = &attrs[b * n];
+                for(int i = 0; i + 2 < mesh->numIndices; i += 3)
+                {
+                    for(int k = 0; k < 3; k++)
+                    {
+                        Uint32 index = mesh->indices[i + k];
+                        tri[k] = srcVerts[index];
+                        triAttrs[k] = srcAttrs[index];
+                    }
+                    DrawPrimitive(TRIANGLE, *target, tri, triAttrs, unis, frag, NULL, zBuf);
+                }
+            }
+        }
+
+        // Job part: an even share of the batch's instances
+        static void shadePart(void* context, const int & part)
+        {
+            InstanceBatch* batch = (InstanceBatch*)context;
+            batch->shadeRange(batch->count * part / batch->parts, batch->count * (part + 1) / batch->parts);
+        }
+
+        // Job part: one band, within the caller's scissor and with its depth test
+        static void drawPart(void* context, const int & part)
+        {
+            TRACE_SCOPE("instance band");
+            InstanceBatch* batch = (InstanceBatch*)context;
+            Scissor & scissor = RasterScissor();
+            Scissor saved = scissor;
+            DEPTH_TEST & test = RasterDepthTest();
+            DEPTH_TEST savedTest = test;
+            scissor = batch->bandBounds;
+            scissor.minY = batch->bandBounds.minY + part * batch->bandHeight;
+            scissor.maxY = MIN(scissor.minY + batch->bandHeight - 1, batch->bandBounds.maxY);
+            test = batch->depthTest;
+            if(scissor.minY <= scissor.maxY)
+            {
+                batch->drawRange(batch->bandTarget, batch->bandFrag, batch->bandZBuf);
+            }
+            test = savedTest;
+            scissor = saved;
+        }
+
+    public:
+        InstanceBatch(Mesh & msh, const InstanceStream & instances, const Attributes* vAttrs,
+                      Attributes* const unis, InstancedVertexShader* const vs)
+            : verts(ThreadInstanceScratch().verts), attrs(ThreadInstanceScratch().attrs)
+        {
+            mesh = &msh;
+            stream = &instances;
+            vertAttrs = vAttrs;
+            uniforms = unis;
+            vert = vs;
+            first = 0;
+            count = 0;
+            parts = 1;
+            bandTarget = NULL;
+            bandFrag = NULL;
+            bandZBuf = NULL;
+            bandHeight = 0;
+            depthTest = DEPTH_LESS;
+
+            // Mesh positions in SoA form once per draw if any matrix is applied
+            positions = NULL;
+            if(instances.transforms != NULL || (vs != NULL && vs->transform != NULL))
+            {
+                positions = &ThreadInstanceScratch().positions;
+                positions->resize(msh.numVertices);
+                for(int i = 0; i < msh.numVertices; i++)
+                {
+                    positions->set(i, msh.vertices[i]);
+                }
+            }
+        }
+
+        // Instances per batch for this mesh
+        int capacity()
+        {
+            return MAX(1, INSTANCE_BATCH_VERTICES / MAX(1, mesh->numVertices));
+        }
+
+        // Shade instances [start, start + num), split by instance across 'threads'
+        void shade(const int & start, const int & num, const int & threads)
+        {
+            first = start;
+            count = num;
+            size_t needed = (size_t)num * mesh->numVertices;
+            if(verts.size() < needed)
+            {
+                verts.resize(needed);
+                attrs.resize(needed);
+            }
+            parts = MAX(1, MIN(threads, num));
+            SharedWorkers().run(shadePart, this, parts);
+        }
+
+        // Rasterize the shaded instances, each thread into its own horizontal band
+        void draw(Buffer2D<PIXEL> & target, FragmentShader* const frag, Buffer2D<DEPTH>* zBuf, const int & threads)
+        {
+            const Scissor & outer = RasterScissor();
+            Scissor bounds;
+            bounds.enabled = true;
+            bounds.minX = outer.enabled ? MAX(outer.minX, 0) : 0;
+            bounds.maxX = outer.enabled ? MIN(outer.maxX, target.width() - 1) : target.width() - 1;
+            bounds.minY = outer.enabled ? MAX(outer.minY, 0) : 0;
+            bounds.maxY = outer.enabled ? MIN(outer.maxY, target.height() - 1) : target.height() - 1;
+            int rows = bounds.maxY - bounds.minY + 1;
+            int workerCount = MAX(1, MIN(threads, rows));
+            if(workerCount == 1 || bounds.minX > bounds.maxX)
+            {
+                drawRange(&target, frag, zBuf);
+                return;
+            }
+
+            bandTarget = &target;
+            bandFrag = frag;
+            bandZBuf = zBuf;
+            bandBounds = bounds;
+            bandHeight = (rows + workerCount - 1) / workerCount;
+            depthTest = RasterDepthTest();
+            SharedWorkers().run(drawPart, this, workerCount);
+            bandTarget = NULL;
+        }
+};
+
+/***************************************************************************
+ * DRAW_MESH_INSTANCED
+ * Draws 'mesh' once per entry of 'instances'. Mesh vertices are shaded
+ * once per instance (not once per triangle corner), with the instance
+ * transforms batched through the SoA kernel. With 'threads' > 1 vertex
+ * shading is split across the SharedWorkers by instance and
+ * rasterization by horizontal band, so shaders must be thread-safe. The image matches
+ * drawing the instances one after another.
+ **************************************************************************/
+void DrawMeshInstanced(Buffer2D<PIXEL>& target,
+                       Mesh & mesh,
+                       const InstanceStream & instances,
+                       const Attributes* vertAttrs = NULL,
+                       Attributes* const uniforms = NULL,
+                       FragmentShader* const frag = NULL,
+                       InstancedVertexShader* const vert = NULL,
+                       Buffer2D<DEPTH>* zBuf = NULL,
+                       int threads = 1)
+{
+    if(instances.count <= 0 || mesh.numIndices < 3)
+    {
+        return;
+    }
+
+    InstanceBatch batch(mesh, instances, vertAttrs, uniforms, vert);
+    int step = batch.capacity();
+    for(int start = 0; start < instances.count; start += step)
+    {
+        batch.shade(start, MIN(step, instances.count - start), threads);
+        batch.draw(target, frag, zBuf, threads);
+    }
+}
+
+#endif
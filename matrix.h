@@ -0,0 +1,458 @@
+#include "definitions.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+/******************************************************
+ * DEFINES:
+ * SIMD lane count of the batch transform kernel. SoA
+ * arrays are padded to a multiple of this width.
+ * Only the single precision pipeline is vectorized.
+ *****************************************************/
+#if defined(__AVX__) && !defined(PIPELINE_DOUBLE)
+#define SIMD_LANES 8
+#elif defined(__SSE__) && !defined(PIPELINE_DOUBLE)
+#define SIMD_LANES 4
+#else
+#define SIMD_LANES 1
+#endif
+#define SIMD_PAD(count) (((count) + 7) & ~7)
+
+/****************************************************
+ * VEC4:
+ * Aligned homogeneous vector, interchangeable with
+ * Vertex.
+ ***************************************************/
+struct alignas(16) Vec4
+{
+    REAL x;
+    REAL y;
+    REAL z;
+    REAL w;
+
+    Vec4() {}
+
+    Vec4(const REAL & vx, const REAL & vy, const REAL & vz, const REAL & vw = 1)
+    {
+        x = vx;
+        y = vy;
+        z = vz;
+        w = vw;
+    }
+
+    Vec4(const Vertex & v)
+    {
+        x = v.x;
+        y = v.y;
+        z = v.z;
+        w = v.w;
+    }
+
+    operator Vertex() const
+    {
+        Vertex v = {x, y, z, w};
+        return v;
+    }
+
+    Vec4 operator-(const Vec4 & rhs) const { return Vec4(x - rhs.x, y - rhs.y, z - rhs.z, w - rhs.w); }
+    REAL dot3(const Vec4 & rhs) const      { return x * rhs.x + y * rhs.y + z * rhs.z; }
+    Vec4 cross3(const Vec4 & rhs) const    { return Vec4(y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z, x * rhs.y - y * rhs.x, 0); }
+
+    // xyz scaled to unit length, w untouched
+    Vec4 normalized3() const
+    {
+        REAL len = sqrt(dot3(*this));
+        return (len > 0) ? Vec4(x / len, y / len, z / len, w) : *this;
+    }
+};
+
+/****************************************************
+ * MATRIX4:
+ * Aligned 4x4 transform stored column-major so that
+ * M * v is a sum of scaled columns. Conventions:
+ * column vectors, left-handed view space looking
+ * down +z, clip depth mapped to [0,1] and screen y
+ * increasing upwards like BufferImage rows.
+ ***************************************************/
+class alignas(16) Matrix4
+{
+    public:
+        REAL m[16];
+
+        // Identity
+        Matrix4()
+        {
+            for(int i = 0; i < 16; i++)
+            {
+                m[i] = (i % 5 == 0) ? 1 : 0;
+            }
+        }
+
+        // Element at row 'r', column 'c'
+        inline REAL & at(const int & r, const int & c)             { return m[c * 4 + r]; }
+        inline const REAL & at(const int & r, const int & c) const { return m[c * 4 + r]; }
+
+        // Concatenation, the right hand side is applied first
+        Matrix4 operator*(const Matrix4 & rhs) const
+        {
+            Matrix4 out;
+#if SIMD_LANES > 1
+            __m128 c0 = _mm_load_ps(m);
+            __m128 c1 = _mm_load_ps(m + 4);
+            __m128 c2 = _mm_load_ps(m + 8);
+            __m128 c3 = _mm_load_ps(m + 12);
+            for(int j = 0; j < 4; j++)
+            {
+                const REAL* b = rhs.m + j * 4;
+                __m128 col = _mm_mul_ps(c0, _mm_set1_ps(b[0]));
+                col = _mm_add_ps(col, _mm_mul_ps(c1, _mm_set1_ps(b[1])));
+                col = _mm_add_ps(col, _mm_mul_ps(c2, _mm_set1_ps(b[2])));
+                col = _mm_add_ps(col, _mm_mul_ps(c3, _mm_set1_ps(b[3])));
+                _mm_store_ps(out.m + j * 4, col);
+            }
+#else
+            for(int j = 0; j < 4; j++)
+            {
+                for(int r = 0; r < 4; r++)
+                {
+                    out.at(r, j) = at(r, 0) * rhs.at(0, j) + at(r, 1) * rhs.at(1, j) +
+                                   at(r, 2) * rhs.at(2, j) + at(r, 3) * rhs.at(3, j);
+                }
+            }
+#endif
+            return out;
+        }
+
+        // Transform a single vector
+        Vec4 operator*(const Vec4 & v) const
+        {
+            Vec4 out;
+#if SIMD_LANES > 1
+            __m128 r = _mm_mul_ps(_mm_load_ps(m), _mm_set1_ps(v.x));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 4), _mm_set1_ps(v.y)));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 8), _mm_set1_ps(v.z)));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 12), _mm_set1_ps(v.w)));
+            _mm_store_ps(&out.x, r);
+#else
+            out.x = m[0] * v.x + m[4] * v.y + m[8]  * v.z + m[12] * v.w;
+            out.y = m[1] * v.x + m[5] * v.y + m[9]  * v.z + m[13] * v.w;
+            out.z = m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14] * v.w;
+            out.w = m[3] * v.x + m[7] * v.y + m[11] * v.z + m[15] * v.w;
+#endif
+            return out;
+        }
+
+        Matrix4 transposed() const
+        {
+            Matrix4 out;
+            for(int r = 0; r < 4; r++)
+            {
+                for(int c = 0; c < 4; c++)
+                {
+                    out.at(r, c) = at(c, r);
+                }
+            }
+            return out;
+        }
+
+        // General inverse by cofactors, false (and identity) if singular
+        bool inverse(Matrix4 & out) const
+        {
+            REAL inv[16];
+            inv[0]  =  m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+            inv[4]  = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+            inv[8]  =  m[4] * m[9]  * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+            inv[12] = -m[4] * m[9]  * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+            inv[1]  = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+            inv[5]  =  m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+            inv[9]  = -m[0] * m[9]  * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+            inv[13] =  m[0] * m[9]  * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+            inv[2]  =  m[1] * m[6]  * m[15] - m[1] * m[7]  * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7]  - m[13] * m[3] * m[6];
+            inv[6]  = -m[0] * m[6]  * m[15] + m[0] * m[7]  * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7]  + m[12] * m[3] * m[6];
+            inv[10] =  m[0] * m[5]  * m[15] - m[0] * m[7]  * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7]  - m[12] * m[3] * m[5];
+            inv[14] = -m[0] * m[5]  * m[14] + m[0] * m[6]  * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6]  + m[12] * m[2] * m[5];
+            inv[3]  = -m[1] * m[6]  * m[11] + m[1] * m[7]  * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9]  * m[2] * m[7]  + m[9]  * m[3] * m[6];
+            inv[7]  =  m[0] * m[6]  * m[11] - m[0] * m[7]  * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8]  * m[2] * m[7]  - m[8]  * m[3] * m[6];
+            inv[11] = -m[0] * m[5]  * m[11] + m[0] * m[7]  * m[9]  + m[4] * m[1] * m[11] - m[4] * m[3] * m[9]  - m[8]  * m[1] * m[7]  + m[8]  * m[3] * m[5];
+            inv[15] =  m[0] * m[5]  * m[10] - m[0] * m[6]  * m[9]  - m[4] * m[1] * m[10] + m[4] * m[2] * m[9]  + m[8]  * m[1] * m[6]  - m[8]  * m[2] * m[5];
+
+            REAL det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+            if(det == 0)
+            {
+                out = Matrix4();
+                return false;
+            }
+            det = 1 / det;
+            for(int i = 0; i < 16; i++)
+            {
+                out.m[i] = inv[i] * det;
+            }
+            return true;
+        }
+
+        /***************************************
+         * BUILDERS
+         **************************************/
+        static Matrix4 translate(const REAL & x, const REAL & y, const REAL & z)
+        {
+            Matrix4 out;
+            out.at(0, 3) = x;
+            out.at(1, 3) = y;
+            out.at(2, 3) = z;
+            return out;
+        }
+
+        static Matrix4 scale(const REAL & x, const REAL & y, const REAL & z)
+        {
+            Matrix4 out;
+            out.at(0, 0) = x;
+            out.at(1, 1) = y;
+            out.at(2, 2) = z;
+            return out;
+        }
+
+        // Rotations in radians around the named axis
+        static Matrix4 rotateX(const REAL & rad)
+        {
+            Matrix4 out;
+            out.at(1, 1) = cos(rad);
+            out.at(1, 2) = -sin(rad);
+            out.at(2, 1) = sin(rad);
+            out.at(2, 2) = cos(rad);
+            return out;
+        }
+
+        static Matrix4 rotateY(const REAL & rad)
+        {
+            Matrix4 out;
+            out.at(0, 0) = cos(rad);
+            out.at(0, 2) = sin(rad);
+            out.at(2, 0) = -sin(rad);
+            out.at(2, 2) = cos(rad);
+            return out;
+        }
+
+        static Matrix4 rotateZ(const REAL & rad)
+        {
+            Matrix4 out;
+            out.at(0, 0) = cos(rad);
+            out.at(0, 1) = -sin(rad);
+            out.at(1, 0) = sin(rad);
+            out.at(1, 1) = cos(rad);
+            return out;
+        }
+
+        // View transform of a camera at 'eye' facing 'target'
+        static Matrix4 lookAt(const Vec4 & eye, const Vec4 & target, const Vec4 & up)
+        {
+            Vec4 zAxis = (target - eye).normalized3();
+            Vec4 xAxis = up.cross3(zAxis).normalized3();
+            Vec4 yAxis = zAxis.cross3(xAxis);
+            Matrix4 out;
+            const Vec4* axes[3] = {&xAxis, &yAxis, &zAxis};
+            for(int r = 0; r < 3; r++)
+            {
+                out.at(r, 0) = axes[r]->x;
+                out.at(r, 1) = axes[r]->y;
+                out.at(r, 2) = axes[r]->z;
+                out.at(r, 3) = -axes[r]->dot3(eye);
+            }
+            return out;
+        }
+
+        // Vertical field of view in radians, w' = z and near/far land on depth 0/1
+        static Matrix4 perspective(const REAL & fovY, const REAL & aspect, const REAL & nearZ, const REAL & farZ)
+        {
+            REAL f = 1 / tan(fovY / 2);
+            Matrix4 out;
+            out.at(0, 0) = f / aspect;
+            out.at(1, 1) = f;
+            out.at(2, 2) = farZ / (farZ - nearZ);
+            out.at(2, 3) = -nearZ * farZ / (farZ - nearZ);
+            out.at(3, 2) = 1;
+            out.at(3, 3) = 0;
+            return out;
+        }
+
+        // Normalized device coordinates to pixel coordinates
+        static Matrix4 viewport(const int & w, const int & h)
+        {
+            Matrix4 out;
+            out.at(0, 0) = w / (REAL)2;
+            out.at(0, 3) = w / (REAL)2;
+            out.at(1, 1) = h / (REAL)2;
+            out.at(1, 3) = h / (REAL)2;
+            return out;
+        }
+};
+
+/*******************************************************
+ * TRANSFORM_VERTICES_SOA
+ * Batch transform kernel over structure-of-arrays
+ * positions. Arrays must be 32-byte aligned and
+ * padded to SIMD_PAD(count) entries, in and out may
+ * alias.
+ ******************************************************/
+void TransformVerticesSoA(const Matrix4 & mat,
+                          const REAL* inX, const REAL* inY, const REAL* inZ, const REAL* inW,
+                          REAL* outX, REAL* outY, REAL* outZ, REAL* outW, const int & count)
+{
+    const REAL* m = mat.m;
+    int i = 0;
+#if SIMD_LANES == 8
+    __m256 b[16];
+    for(int k = 0; k < 16; k++)
+    {
+        b[k] = _mm256_set1_ps(m[k]);
+    }
+    for(; i < count; i += 8)
+    {
+        __m256 x = _mm256_load_ps(inX + i);
+        __m256 y = _mm256_load_ps(inY + i);
+        __m256 z = _mm256_load_ps(inZ + i);
+        __m256 w = _mm256_load_ps(inW + i);
+        for(int r = 0; r < 4; r++)
+        {
+            __m256 acc = _mm256_mul_ps(b[r], x);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(b[4 + r], y));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(b[8 + r], z));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(b[12 + r], w));
+            REAL* out = (r == 0) ? outX : (r == 1) ? outY : (r == 2) ? outZ : outW;
+            _mm256_store_ps(out + i, acc);
+        }
+    }
+#elif SIMD_LANES == 4
+    __m128 b[16];
+    for(int k = 0; k < 16; k++)
+    {
+        b[k] = _mm_set1_ps(m[k]);
+    }
+    for(; i < count; i += 4)
+    {
+        __m128 x = _mm_load_ps(inX + i);
+        __m128 y = _mm_load_ps(inY + i);
+        __m128 z = _mm_load_ps(inZ + i);
+        __m128 w = _mm_load_ps(inW + i);
+        for(int r = 0; r < 4; r++)
+        {
+            __m128 acc = _mm_mul_ps(b[r], x);
+            acc = _mm_add_ps(acc, _mm_mul_ps(b[4 + r], y));
+            acc = _mm_add_ps(acc, _mm_mul_ps(b[8 + r], z));
+            acc = _mm_add_ps(acc, _mm_mul_ps(b[12 + r], w));
+            REAL* out = (r == 0) ? outX : (r == 1) ? outY : (r == 2) ? outZ : outW;
+            _mm_store_ps(out + i, acc);
+        }
+    }
+#else
+    for(; i < count; i++)
+    {
+        REAL x = inX[i];
+        REAL y = inY[i];
+        REAL z = inZ[i];
+        REAL w = inW[i];
+        outX[i] = m[0] * x + m[4] * y + m[8]  * z + m[12] * w;
+        outY[i] = m[1] * x + m[5] * y + m[9]  * z + m[13] * w;
+        outZ[i] = m[2] * x + m[6] * y + m[10] * z + m[14] * w;
+        outW[i] = m[3] * x + m[7] * y + m[11] * z + m[15] * w;
+    }
+#endif
+}
+
+/****************************************************
+ * VERTEX_ARRAY_SOA:
+ * Aligned, padded structure-of-arrays positions for
+ * the batch transform kernel.
+ ***************************************************/
+class VertexArraySoA
+{
+    protected:
+        int count;
+        int capacity;                   // Padded entries allocated per plane
+
+        // Copying would alias the planes
+        VertexArraySoA(const VertexArraySoA &);
+        VertexArraySoA& operator=(const VertexArraySoA &);
+
+    public:
+        REAL* x;
+        REAL* y;
+        REAL* z;
+        REAL* w;
+
+        // Zero filled, padding included
+        VertexArraySoA(const int & num)
+        {
+            count = num;
+            int padded = SIMD_PAD(num);
+            capacity = padded;
+            REAL** planes[4] = {&x, &y, &z, &w};
+            for(int p = 0; p < 4; p++)
+            {
+                *planes[p] = (REAL*)alignedMalloc(sizeof(REAL) * padded);
+                for(int i = 0; i < padded; i++)
+                {
+                    (*planes[p])[i] = 0;
+                }
+            }
+        }
+
+        // Free dynamic memory
+        ~VertexArraySoA()
+        {
+            alignedFree(x);
+            alignedFree(y);
+            alignedFree(z);
+            alignedFree(w);
+        }
+
+        const int & size() { return count; }
+
+        // Change the count, the planes are reallocated (zero filled) only to grow
+        void resize(const int & num)
+        {
+            int padded = SIMD_PAD(num);
+            if(padded > capacity)
+            {
+                REAL** planes[4] = {&x, &y, &z, &w};
+                for(int p = 0; p < 4; p++)
+                {
+                    alignedFree(*planes[p]);
+                    *planes[p] = (REAL*)alignedMalloc(sizeof(REAL) * padded);
+                    for(int i = 0; i < padded; i++)
+                    {
+                        (*planes[p])[i] = 0;
+                    }
+                }
+                capacity = padded;
+            }
+            count = num;
+        }
+
+        inline void set(const int & i, const Vertex & v)
+        {
+            x[i] = v.x;
+            y[i] = v.y;
+            z[i] = v.z;
+            w[i] = v.w;
+        }
+
+        inline Vertex get(const int & i) const
+        {
+            Vertex v = {x[i], y[i], z[i], w[i]};
+            return v;
+        }
+
+        // Apply 'mat' to every position, writing to 'out' (may be this array)
+        void transform(const Matrix4 & mat, VertexArraySoA & out) const
+        {
+            TransformVerticesSoA(mat, x, y, z, w, out.x, out.y, out.z, out.w, SIMD_PAD(count));
+        }
+};
+
+#endif
@@ -0,0 +1,819 @@
+#include "definitions.h"
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef MESH_H
+#define MESH_H
+
+/******************************************************
+ * DEFINES:
+ * Binary mesh cache identification and the smallest
+ * OBJ chunk worth handing to its own parser thread.
+ *****************************************************/
+#define MESH_CACHE_MAGIC   0x4853454d    // "MESH"
+#define MESH_CACHE_VERSION 2
+#define MESH_MIN_CHUNK     (1 << 20)
+#define OBJ_RELATIVE       (1 << 30)
+
+/****************************************************
+ * MAPPED_FILE:
+ * Read-only memory mapping of a whole file, POSIX
+ * mmap or a Win32 file mapping.
+ ***************************************************/
+class MappedFile
+{
+    protected:
+        const char* bytes;
+        size_t length;
+#ifdef _WIN32
+        HANDLE file;
+        HANDLE mapping;
+#endif
+
+        // Copying would double-unmap
+        MappedFile(const MappedFile &);
+        MappedFile& operator=(const MappedFile &);
+
+    public:
+        MappedFile(const char* path)
+        {
+            bytes = NULL;
+            length = 0;
+#ifdef _WIN32
+            mapping = NULL;
+            file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if(file == INVALID_HANDLE_VALUE)
+            {
+                return;
+            }
+            LARGE_INTEGER size;
+            GetFileSizeEx(file, &size);
+            length = (size_t)size.QuadPart;
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if(mapping != NULL)
+            {
+                bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+#else
+            int fd = open(path, O_RDONLY);
+            if(fd < 0)
+            {
+                return;
+            }
+            struct stat info;
+            if(fstat(fd, &info) == 0 && info.st_size > 0)
+            {
+                length = (size_t)info.st_size;
+                void* addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(addr != MAP_FAILED)
+                {
+                    madvise(addr, length, MADV_SEQUENTIAL);
+                    bytes = (const char*)addr;
+                }
+            }
+            close(fd);
+#endif
+            if(bytes == NULL)
+            {
+                length = 0;
+            }
+        }
+
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if(bytes != NULL)
+            {
+                UnmapViewOfFile(bytes);
+            }
+            if(mapping != NULL)
+            {
+                CloseHandle(mapping);
+            }
+            if(file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file);
+            }
+#else
+            if(bytes != NULL)
+            {
+                munmap((void*)bytes, length);
+            }
+#endif
+        }
+
+        bool valid()         { return bytes != NULL; }
+        const char* data()   { return bytes; }
+        const size_t & size() { return length; }
+};
+
+/****************************************************
+ * MESH:
+ * Indexed triangle list. Every unique position/uv/
+ * normal combination of the source is one vertex,
+ * 'indices' holds three entries per triangle. uv and
+ * normal arrays are either empty or vertex-parallel.
+ * When loaded from a binary cache the arrays point
+ * straight into the mapping (see LoadMeshCache).
+ ***************************************************/
+struct MeshTexCoord
+{
+    REAL u;
+    REAL v;
+};
+
+struct MeshNormal
+{
+    REAL x;
+    REAL y;
+    REAL z;
+};
+
+class Mesh
+{
+    protected:
+        std::vector<Vertex> ownVerts;
+        std::vector<MeshTexCoord> ownUVs;
+        std::vector<MeshNormal> ownNormals;
+        std::vector<Uint32> ownIndices;
+        MappedFile* mapping;
+
+        // Copying would alias the mapping
+        Mesh(const Mesh &);
+        Mesh& operator=(const Mesh &);
+
+        void adoptOwned()
+        {
+            vertices = ownVerts.empty() ? NULL : &ownVerts[0];
+            uvs = ownUVs.empty() ? NULL : &ownUVs[0];
+            normals = ownNormals.empty() ? NULL : &ownNormals[0];
+            indices = ownIndices.empty() ? NULL : &ownIndices[0];
+            numVertices = (int)ownVerts.size();
+            numIndices = (int)ownIndices.size();
+            updateBounds();
+        }
+
+        friend bool LoadOBJ(Mesh & mesh, const char* path, int threads);
+        friend bool LoadMeshCache(Mesh & mesh, const char* path, const char* objPath);
+
+    public:
+        const Vertex* vertices;
+        const MeshTexCoord* uvs;
+        const MeshNormal* normals;
+        const Uint32* indices;
+        int numVertices;
+        int numIndices;
+        Vertex boundsMin;               // Of all vertices, set by the loaders
+        Vertex boundsMax;
+
+        Mesh()
+        {
+            mapping = NULL;
+            adoptOwned();
+        }
+
+        ~Mesh()
+        {
+            delete mapping;
+        }
+
+        // Drop all geometry and any mapping
+        void clear()
+        {
+            ownVerts.clear();
+            ownUVs.clear();
+            ownNormals.clear();
+            ownIndices.clear();
+            delete mapping;
+            mapping = NULL;
+            adoptOwned();
+        }
+
+        int numTriangles() { return numIndices / 3; }
+
+        // Recompute boundsMin/boundsMax, call after changing the vertices
+        void updateBounds()
+        {
+            Vertex lo = {0, 0, 0, 1};
+            Vertex hi = {0, 0, 0, 1};
+            for(int i = 0; i < numVertices; i++)
+            {
+                const Vertex & v = vertices[i];
+                lo.x = (i == 0) ? v.x : MIN(lo.x, v.x);
+                lo.y = (i == 0) ? v.y : MIN(lo.y, v.y);
+                lo.z = (i == 0) ? v.z : MIN(lo.z, v.z);
+                hi.x = (i == 0) ? v.x : MAX(hi.x, v.x);
+                hi.y = (i == 0) ? v.y : MAX(hi.y, v.y);
+                hi.z = (i == 0) ? v.z : MAX(hi.z, v.z);
+            }
+            boundsMin = lo;
+            boundsMax = hi;
+        }
+};
+
+/****************************************************
+ * OBJ_TOKENIZER:
+ * Allocation-free scanning over a character range.
+ * Numbers are parsed in place without strtod, lines
+ * are never copied.
+ ***************************************************/
+class OBJTokenizer
+{
+    protected:
+        const char* cur;
+        const char* end;
+
+    public:
+        OBJTokenizer(const char* begin, const char* stop)
+        {
+            cur = begin;
+            end = stop;
+        }
+
+        inline bool done() { return cur >= end; }
+
+        inline void skipSpaces()
+        {
+            while(cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r'))
+            {
+                cur++;
+            }
+        }
+
+        inline void nextLine()
+        {
+            while(cur < end && *cur != '\n')
+            {
+                cur++;
+            }
+            cur++;
+        }
+
+        inline bool atLineEnd()
+        {
+            skipSpaces();
+            return cur >= end || *cur == '\n' || *cur == '#';
+        }
+
+        // Keyword of the current line, returns its length (0 for blank/comment)
+        inline int keyword(const char* & word)
+        {
+            skipSpaces();
+            word = cur;
+            while(cur < end && *cur > ' ')
+            {
+                cur++;
+            }
+            return (word >= end || *word == '#') ? 0 : (int)(cur - word);
+        }
+
+        inline REAL readReal()
+        {
+            skipSpaces();
+            bool neg = false;
+            if(cur < end && (*cur == '-' || *cur == '+'))
+            {
+                neg = (*cur == '-');
+                cur++;
+            }
+            double value = 0;
+            while(cur < end && *cur >= '0' && *cur <= '9')
+            {
+                value = value * 10 + (*cur++ - '0');
+            }
+            if(cur < end && *cur == '.')
+            {
+                cur++;
+                double place = 0.1;
+                while(cur < end && *cur >= '0' && *cur <= '9')
+                {
+                    value += (*cur++ - '0') * place;
+                    place *= 0.1;
+                }
+            }
+            if(cur < end && (*cur == 'e' || *cur == 'E'))
+            {
+                cur++;
+                bool negExp = false;
+                if(cur < end && (*cur == '-' || *cur == '+'))
+                {
+                    negExp = (*cur == '-');
+                    cur++;
+                }
+                int exponent = 0;
+                while(cur < end && *cur >= '0' && *cur <= '9')
+                {
+                    exponent = exponent * 10 + (*cur++ - '0');
+                }
+                value *= pow(10.0, negExp ? -exponent : exponent);
+            }
+            return (REAL)(neg ? -value : value);
+        }
+
+        // Signed integer, 0 when absent (OBJ indices are never 0)
+        inline int readInt()
+        {
+            bool neg = false;
+            if(cur < end && *cur == '-')
+            {
+                neg = true;
+                cur++;
+            }
+            int value = 0;
+            while(cur < end && *cur >= '0' && *cur <= '9')
+            {
+                value = value * 10 + (*cur++ - '0');
+            }
+            return neg ? -value : value;
+        }
+
+        // One "v", "v/t", "v//n" or "v/t/n" face corner, false on garbage
+        inline bool readCorner(int corner[3])
+        {
+            skipSpaces();
+            const char* start = cur;
+            corner[0] = readInt();
+            if(cur == start)
+            {
+                return false;
+            }
+            corner[1] = 0;
+            corner[2] = 0;
+            if(cur < end && *cur == '/')
+            {
+                cur++;
+                corner[1] = readInt();
+                if(cur < end && *cur == '/')
+                {
+                    cur++;
+                    corner[2] = readInt();
+                }
+            }
+            return true;
+        }
+};
+
+/****************************************************
+ * OBJ_CHUNK:
+ * Raw results of parsing one slice of the file. Face
+ * indices are kept as written, except that relative
+ * (negative) ones are rewritten to chunk-local offsets
+ * biased by OBJ_RELATIVE (they may reach back into
+ * earlier chunks) and rebased once the sizes of
+ * earlier chunks are known.
+ ***************************************************/
+struct OBJChunk
+{
+    std::vector<Vertex> positions;
+    std::vector<MeshTexCoord> uvs;
+    std::vector<MeshNormal> normals;
+    std::vector<int> corners;    // v,t,n triples, three corners per triangle
+
+    void parse(const char* begin, const char* end)
+    {
+        OBJTokenizer tok(begin, end);
+        int poly[3];
+        int first[3];
+        int prev[3];
+        while(!tok.done())
+        {
+            const char* word;
+            int len = tok.keyword(word);
+            if(len == 1 && word[0] == 'v')
+            {
+                Vertex v;
+                v.x = tok.readReal();
+                v.y = tok.readReal();
+                v.z = tok.readReal();
+                v.w = 1;
+                positions.push_back(v);
+            }
+            else if(len == 2 && word[0] == 'v' && word[1] == 't')
+            {
+                MeshTexCoord t;
+                t.u = tok.readReal();
+                t.v = tok.readReal();
+                uvs.push_back(t);
+            }
+            else if(len == 2 && word[0] == 'v' && word[1] == 'n')
+            {
+                MeshNormal n;
+                n.x = tok.readReal();
+                n.y = tok.readReal();
+                n.z = tok.readReal();
+                normals.push_back(n);
+            }
+            else if(len == 1 && word[0] == 'f')
+            {
+                // Polygons are fanned into triangles
+                int count = 0;
+                while(!tok.atLineEnd() && tok.readCorner(poly))
+                {
+                    makeLocal(poly);
+                    if(count == 0)
+                    {
+                        first[0] = poly[0]; first[1] = poly[1]; first[2] = poly[2];
+                    }
+                    else if(count >= 2)
+                    {
+                        corners.insert(corners.end(), first, first + 3);
+                        corners.insert(corners.end(), prev, prev + 3);
+                        corners.insert(corners.end(), poly, poly + 3);
+                    }
+                    prev[0] = poly[0]; prev[1] = poly[1]; prev[2] = poly[2];
+                    count++;
+                }
+            }
+            tok.nextLine();
+        }
+    }
+
+    // Relative indices resolve against what this chunk has seen so far
+    inline void makeLocal(int corner[3])
+    {
+        int sizes[3] = {(int)positions.size(), (int)uvs.size(), (int)normals.size()};
+        for(int i = 0; i < 3; i++)
+        {
+            if(corner[i] < 0)
+            {
+                corner[i] = sizes[i] + corner[i] - OBJ_RELATIVE;
+            }
+        }
+    }
+};
+
+// Resolved v/t/n corner, the unit of vertex de-duplication
+struct OBJCorner
+{
+    int v;
+    int t;
+    int n;
+
+    bool operator==(const OBJCorner & rhs) const
+    {
+        return v == rhs.v && t == rhs.t && n == rhs.n;
+    }
+};
+
+struct OBJCornerHash
+{
+    size_t operator()(const OBJCorner & c) const
+    {
+        unsigned long long key = (unsigned long long)(Uint32)c.v * 0x9e3779b97f4a7c15ull;
+        key ^= (unsigned long long)(Uint32)c.t * 0xbf58476d1ce4e5b9ull + (key >> 31);
+        key ^= (unsigned long long)(Uint32)c.n * 0x94d049bb133111ebull + (key >> 29);
+        return (size_t)key;
+    }
+};
+
+/*******************************************************
+ * LOAD_OBJ
+ * Parses a Wavefront OBJ (v, vt, vn, f) into 'mesh'.
+ * The file is memory mapped and split on line ends
+ * across 'threads' parsers (0 = hardware concurrency),
+ * then corners are de-duplicated into an indexed
+ * vertex buffer. Returns false if the file can't be
+ * read or a face refers to a missing v, vt or vn.
+ ******************************************************/
+bool LoadOBJ(Mesh & mesh, const char* path, int threads = 0)
+{
+    mesh.clear();
+    MappedFile file(path);
+    if(!file.valid())
+    {
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // Split on line boundaries
+    if(threads <= 0)
+    {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    size_t maxChunks = size / MESH_MIN_CHUNK + 1;
+    size_t wanted = (size_t)MAX(threads, 1);
+    int numChunks = (int)MIN(wanted, maxChunks);
+    std::vector<const char*> bounds(numChunks + 1);
+    bounds[0] = data;
+    bounds[numChunks] = data + size;
+    for(int c = 1; c < numChunks; c++)
+    {
+        const char* cut = data + (size * c) / numChunks;
+        while(cut < data + size && *cut != '\n')
+        {
+            cut++;
+        }
+        bounds[c] = (cut < data + size) ? cut + 1 : cut;
+    }
+
+    std::vector<OBJChunk> chunks(numChunks);
+    if(numChunks == 1)
+    {
+        chunks[0].parse(bounds[0], bounds[1]);
+    }
+    else
+    {
+        std::vector<std::thread> workers;
+        for(int c = 0; c < numChunks; c++)
+        {
+            workers.push_back(std::thread(&OBJChunk::parse, &chunks[c], bounds[c], bounds[c + 1]));
+        }
+        for(size_t t = 0; t < workers.size(); t++)
+        {
+            workers[t].join();
+        }
+    }
+
+    // Gather attribute pools, remembering where each chunk starts
+    std::vector<Vertex> positions;
+    std::vector<MeshTexCoord> uvs;
+    std::vector<MeshNormal> normals;
+    std::vector<int> base(numChunks * 3);
+    size_t totalCorners = 0;
+    for(int c = 0; c < numChunks; c++)
+    {
+        base[c * 3 + 0] = (int)positions.size();
+        base[c * 3 + 1] = (int)uvs.size();
+        base[c * 3 + 2] = (int)normals.size();
+        positions.insert(positions.end(), chunks[c].positions.begin(), chunks[c].positions.end());
+        uvs.insert(uvs.end(), chunks[c].uvs.begin(), chunks[c].uvs.end());
+        normals.insert(normals.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+        totalCorners += chunks[c].corners.size() / 3;
+    }
+
+    // De-duplicate corners into the indexed buffer
+    bool hasUV = !uvs.empty();
+    bool hasNormal = !normals.empty();
+    std::unordered_map<OBJCorner, Uint32, OBJCornerHash> unique;
+    unique.reserve(totalCorners);
+    mesh.ownIndices.reserve(totalCorners);
+    for(int c = 0; c < numChunks; c++)
+    {
+        const std::vector<int> & corners = chunks[c].corners;
+        for(size_t i = 0; i < corners.size(); i += 3)
+        {
+            // 0-based global indices, -1 when absent (a position is required)
+            int idx[3];
+            int sizes[3] = {(int)positions.size(), (int)uvs.size(), (int)normals.size()};
+            for(int k = 0; k < 3; k++)
+            {
+                int raw = corners[i + k];
+                idx[k] = (raw > 0) ? raw - 1 : (raw < 0 ? base[c * 3 + k] + raw + OBJ_RELATIVE : -1);
+                bool absent = (raw == 0 && k > 0);
+                if(!absent && (idx[k] < 0 || idx[k] >= sizes[k]))
+                {
+                    mesh.clear();
+                    return false;
+                }
+            }
+
+            OBJCorner key = {idx[0], idx[1], idx[2]};
+            std::pair<std::unordered_map<OBJCorner, Uint32, OBJCornerHash>::iterator, bool> slot =
+                unique.insert(std::make_pair(key, (Uint32)mesh.ownVerts.size()));
+            if(slot.second)
+            {
+                mesh.ownVerts.push_back(positions[idx[0]]);
+                if(hasUV)
+                {
+                    MeshTexCoord none = {0, 0};
+                    mesh.ownUVs.push_back(idx[1] >= 0 ? uvs[idx[1]] : none);
+                }
+                if(hasNormal)
+                {
+                    MeshNormal none = {0, 0, 0};
+                    mesh.ownNormals.push_back(idx[2] >= 0 ? normals[idx[2]] : none);
+                }
+            }
+            mesh.ownIndices.push_back(slot.first->second);
+        }
+    }
+
+    mesh.adoptOwned();
+    return true;
+}
+
+/****************************************************
+ * MESH_CACHE:
+ * Binary layout written by SaveMeshCache. Arrays
+ * follow the header in the order vertices, uvs,
+ * normals, indices, each starting 16-byte aligned so
+ * a mapping can be used in place.
+ ***************************************************/
+struct MeshCacheHeader
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint32 realSize;
+    Uint32 numVertices;
+    Uint32 numIndices;
+    Uint32 hasUV;
+    Uint32 hasNormal;
+    Uint32 reserved;
+    Uint64 sourceSize;      // Of the OBJ it was built from, 0 if unknown
+    Uint64 sourceTime;      // Its modification time
+};
+
+// Size and modification time of a cache's source file, false if it can't be read
+inline bool MeshSourceStamp(const char* path, Uint64 & size, Uint64 & time)
+{
+    struct stat info;
+    if(path == NULL || stat(path, &info) != 0)
+    {
+        size = 0;
+        time = 0;
+        return false;
+    }
+    size = (Uint64)info.st_size;
+    time = (Uint64)info.st_mtime;
+    return true;
+}
+
+inline size_t MeshCacheAlign(size_t offset)
+{
+    return (offset + 15) & ~(size_t)15;
+}
+
+/*******************************************************
+ * SAVE_MESH_CACHE
+ * Writes 'mesh' in the binary cache layout, stamped
+ * with the size and time of 'objPath' if given.
+ * Returns false if the file can't be written.
+ ******************************************************/
+bool SaveMeshCache(Mesh & mesh, const char* path, const char* objPath = NULL)
+{
+    FILE* out = fopen(path, "wb");
+    if(out == NULL)
+    {
+        return false;
+    }
+
+    MeshCacheHeader header;
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.realSize = sizeof(REAL);
+    header.numVertices = mesh.numVertices;
+    header.numIndices = mesh.numIndices;
+    header.hasUV = (mesh.uvs != NULL);
+    header.hasNormal = (mesh.normals != NULL);
+    header.reserved = 0;
+    MeshSourceStamp(objPath, header.sourceSize, header.sourceTime);
+
+    const void* arrays[4] = {mesh.vertices, mesh.uvs, mesh.normals, mesh.indices};
+    size_t bytes[4] = {sizeof(Vertex) * mesh.numVertices,
+                       header.hasUV ? sizeof(MeshTexCoord) * mesh.numVertices : 0,
+                       header.hasNormal ? sizeof(MeshNormal) * mesh.numVertices : 0,
+                       sizeof(Uint32) * mesh.numIndices};
+
+    static const char padding[16] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    size_t offset = sizeof(header);
+    for(int a = 0; a < 4 && ok; a++)
+    {
+        size_t aligned = MeshCacheAlign(offset);
+        ok = fwrite(padding, 1, aligned - offset, out) == aligned - offset;
+        if(ok && bytes[a] > 0)
+        {
+            ok = fwrite(arrays[a], 1, bytes[a], out) == bytes[a];
+        }
+        offset = aligned + bytes[a];
+    }
+    return (fclose(out) == 0) && ok;
+}
+
+/*******************************************************
+ * LOAD_MESH_CACHE
+ * Maps a binary cache and points 'mesh' into it, no
+ * parsing or copying. Returns false if the file is
+ * missing, truncated, written with another REAL, has
+ * an index past its vertices, or is stale: built
+ * from a different 'objPath' than the one on disk.
+ ******************************************************/
+bool LoadMeshCache(Mesh & mesh, const char* path, const char* objPath = NULL)
+{
+    mesh.clear();
+    MappedFile* file = new MappedFile(path);
+    if(!file->valid() || file->size() < sizeof(MeshCacheHeader))
+    {
+        delete file;
+        return false;
+    }
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)file->data();
+    size_t bytes[4] = {sizeof(Vertex) * header->numVertices,
+                       header->hasUV ? sizeof(MeshTexCoord) * header->numVertices : 0,
+                       header->hasNormal ? sizeof(MeshNormal) * header->numVertices : 0,
+                       sizeof(Uint32) * header->numIndices};
+    size_t starts[4];
+    size_t offset = sizeof(MeshCacheHeader);
+    for(int a = 0; a < 4; a++)
+    {
+        starts[a] = MeshCacheAlign(offset);
+        offset = starts[a] + bytes[a];
+    }
+    if(header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+       header->realSize != sizeof(REAL) || offset > file->size())
+    {
+        delete file;
+        return false;
+    }
+
+    // A missing OBJ leaves the cache as the only copy, otherwise it must match
+    Uint64 sourceSize;
+    Uint64 sourceTime;
+    if(MeshSourceStamp(objPath, sourceSize, sourceTime) &&
+       (sourceSize != header->sourceSize || sourceTime != header->sourceTime))
+    {
+        delete file;
+        return false;
+    }
+
+    // Checked once here so DrawMesh can trust the indices
+    const char* base = file->data();
+    const Uint32* indices = (const Uint32*)(base + starts[3]);
+    for(Uint32 i = 0; i < header->numIndices; i++)
+    {
+        if(indices[i] >= header->numVertices)
+        {
+            delete file;
+            return false;
+        }
+    }
+
+    mesh.mapping = file;
+    mesh.vertices = (const Vertex*)(base + starts[0]);
+    mesh.uvs = header->hasUV ? (const MeshTexCoord*)(base + starts[1]) : NULL;
+    mesh.normals = header->hasNormal ? (const MeshNormal*)(base + starts[2]) : NULL;
+    mesh.indices = indices;
+    mesh.numVertices = header->numVertices;
+    mesh.numIndices = header->numIndices;
+    mesh.updateBounds();
+    return true;
+}
+
+/*******************************************************
+ * LOAD_MESH
+ * Uses the binary cache at 'cachePath' when present
+ * and built from the current OBJ, otherwise parses
+ * the OBJ and writes the cache for the next run.
+ ******************************************************/
+bool LoadMesh(Mesh & mesh, const char* objPath, const char* cachePath, int threads = 0)
+{
+    if(cachePath != NULL && LoadMeshCache(mesh, cachePath, objPath))
+    {
+        return true;
+    }
+    if(!LoadOBJ(mesh, objPath, threads))
+    {
+        return false;
+    }
+    if(cachePath != NULL)
+    {
+        SaveMeshCache(mesh, cachePath, objPath);
+    }
+    return true;
+}
+
+/****************************************************
+ * DRAW_MESH
+ * Feeds every triangle of 'mesh' through
+ * DrawPrimitive. 'vertAttrs' is either NULL or one
+ * Attributes per mesh vertex, built by the
+ * programmer from mesh.uvs/normals.
+ ***************************************************/
+void DrawMesh(Buffer2D<PIXEL>& target,
+              Mesh & mesh,
+              const Attributes* vertAttrs = NULL,
+              Attributes* const uniforms = NULL,
+              FragmentShader* const frag = NULL,
+              VertexShader* const vert = NULL,
+              Buffer2D<DEPTH>* zBuf = NULL)
+{
+    Vertex tri[3];
+    Attributes attrs[3];
+    for(int i = 0; i + 2 < mesh.numIndices; i += 3)
+    {
+        for(int k = 0; k < 3; k++)
+        {
+            Uint32 index = mesh.indices[i + k];
+            tri[k] = mesh.vertices[index];
+            if(vertAttrs != NULL)
+            {
+                attrs[k] = vertAttrs[index];
+            }
+        }
+        DrawPrimitive(TRIANGLE, target, tri, attrs, uniforms, frag, vert, zBuf);
+    }
+}
+
+#endif
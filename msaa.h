@@ -0,0 +1,292 @@
+#include "definitions.h"
+#include "rasterizer.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef MSAA_H
+#define MSAA_H
+
+/******************************************************
+ * DEFINES:
+ * Multisample resolve tiles are MSAA_TILE x MSAA_TILE
+ * pixels. Sample positions are in 1/16th of a pixel
+ * from the pixel's upper-left corner (D3D patterns).
+ *****************************************************/
+#define MSAA_TILE 8
+
+static const int MSAA_POSITIONS_2X[2][2] = { {12, 12}, {4, 4} };
+static const int MSAA_POSITIONS_4X[4][2] = { {6, 2}, {14, 6}, {2, 10}, {10, 14} };
+static const int MSAA_POSITIONS_8X[8][2] = { {9, 5}, {7, 11}, {13, 9}, {5, 3},
+                                             {3, 13}, {1, 7}, {11, 15}, {15, 1} };
+
+/****************************************************
+ * MSAA_BUFFER:
+ * Multisampled render target with 2, 4 or 8 samples
+ * per pixel. Each sample stores a PIXEL color and a
+ * 32-bit float depth, sample-interleaved per pixel
+ * so that one pixel's colors are contiguous for the
+ * resolve. Tiles only ever written with full pixel
+ * coverage are resolved by copying sample zero.
+ ***************************************************/
+class MSAABuffer
+{
+    protected:
+        PIXEL* color;
+        float* depth;
+        bool* complexTile;
+        int w;
+        int h;
+        int samples;
+        int shift;
+        int tilesX;
+        int tilesY;
+        const int (*positions)[2];
+
+        // Copying would alias the sample planes
+        MSAABuffer(const MSAABuffer &);
+        MSAABuffer& operator=(const MSAABuffer &);
+
+    public:
+        // Size and sample count specified, unsupported counts fall back to 4x
+        MSAABuffer(const int & wid, const int & hgt, const int & sampleCount = 4)
+        {
+            w = wid;
+            h = hgt;
+            switch(sampleCount)
+            {
+                case 2:
+                    samples = 2;
+                    shift = 1;
+                    positions = MSAA_POSITIONS_2X;
+                    break;
+                case 8:
+                    samples = 8;
+                    shift = 3;
+                    positions = MSAA_POSITIONS_8X;
+                    break;
+                default:
+                    samples = 4;
+                    shift = 2;
+                    positions = MSAA_POSITIONS_4X;
+            }
+            tilesX = (w + MSAA_TILE - 1) / MSAA_TILE;
+            tilesY = (h + MSAA_TILE - 1) / MSAA_TILE;
+            color = (PIXEL*)alignedMalloc(sizeof(PIXEL) * w * h * samples);
+            depth = (float*)alignedMalloc(sizeof(float) * w * h * samples);
+            complexTile = (bool*)malloc(sizeof(bool) * tilesX * tilesY);
+            clear();
+        }
+
+        // Free dynamic memory
+        ~MSAABuffer()
+        {
+            alignedFree(color);
+            alignedFree(depth);
+            free(complexTile);
+        }
+
+        // Reset every sample, all tiles become simple again
+        void clear(PIXEL clearColor = 0xff000000, float clearDepth = FLT_MAX)
+        {
+            int count = w * h * samples;
+            for(int i = 0; i < count; i++)
+            {
+                color[i] = clearColor;
+                depth[i] = clearDepth;
+            }
+            for(int t = 0; t < tilesX * tilesY; t++)
+            {
+                complexTile[t] = false;
+            }
+        }
+
+        // Width, height, samples per pixel
+        const int & width() const       { return w; }
+        const int & height() const      { return h; }
+        const int & sampleCount() const { return samples; }
+
+        // Sample offsets within a pixel, in pixels
+        inline REAL sampleX(const int & s) const { return positions[s][0] / (REAL)16; }
+        inline REAL sampleY(const int & s) const { return positions[s][1] / (REAL)16; }
+
+        // First color/depth sample of a pixel
+        inline PIXEL* colorSamples(const int & x, const int & y) { return color + (y * w + x) * samples; }
+        inline float* depthSamples(const int & x, const int & y) { return depth + (y * w + x) * samples; }
+
+        // A pixel received partial coverage, its tile needs a full resolve
+        inline void markComplex(const int & x, const int & y)
+        {
+            complexTile[(y / MSAA_TILE) * tilesX + (x / MSAA_TILE)] = true;
+        }
+
+        // Box filter all samples of one pixel
+        inline PIXEL resolvePixel(const PIXEL* s) const
+        {
+#ifdef __SSE2__
+            __m128i zero = _mm_setzero_si128();
+            __m128i acc;
+            if(samples == 2)
+            {
+                acc = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)s), zero);
+            }
+            else
+            {
+                acc = zero;
+                for(int i = 0; i < samples; i += 4)
+                {
+                    __m128i quad = _mm_load_si128((const __m128i*)(s + i));
+                    acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(quad, zero));
+                    acc = _mm_add_epi16(acc, _mm_unpackhi_epi8(quad, zero));
+                }
+            }
+            acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+            acc = _mm_srli_epi16(acc, shift);
+            return (PIXEL)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+#else
+            Uint32 sum[4] = {0, 0, 0, 0};
+            for(int i = 0; i < samples; i++)
+            {
+                for(int c = 0; c < 4; c++)
+                {
+                    sum[c] += (s[i] >> (c * 8)) & 0xff;
+                }
+            }
+            PIXEL out = 0;
+            for(int c = 0; c < 4; c++)
+            {
+                out |= (sum[c] >> shift) << (c * 8);
+            }
+            return out;
+#endif
+        }
+
+        // Downsample into a single sample target of the same size
+        void resolve(Buffer2D<PIXEL> & target)
+        {
+            for(int ty = 0; ty < tilesY; ty++)
+            {
+                int yEnd = MIN((ty + 1) * MSAA_TILE, h);
+                for(int tx = 0; tx < tilesX; tx++)
+                {
+                    int xEnd = MIN((tx + 1) * MSAA_TILE, w);
+                    bool full = !complexTile[ty * tilesX + tx];
+                    for(int y = ty * MSAA_TILE; y < yEnd; y++)
+                    {
+                        PIXEL* row = target[y];
+                        for(int x = tx * MSAA_TILE; x < xEnd; x++)
+                        {
+                            const PIXEL* s = colorSamples(x, y);
+                            row[x] = full ? s[0] : resolvePixel(s);
+                        }
+                    }
+                }
+            }
+        }
+};
+
+/*************************************************************
+ * DRAW_TRIANGLE_MSAA
+ * Rasterizes a triangle into a multisampled target. Coverage
+ * and depth are evaluated per sample, depth on the shared
+ * plane and compared per RasterDepthTest. The fragment shader
+ * runs once per pixel at its center and the result is
+ * written to every sample that passed.
+ ************************************************************/
+void DrawTriangleMSAA(MSAABuffer & target, Vertex* const triangle, Attributes* const attrs, Attributes* const uniforms, FragmentShader* const frag)
+{
+    TriangleSetup tri;
+    if(!tri.setup(triangle, target.width(), target.height()))
+    {
+        return;
+    }
+
+    static const FragmentShader defaultFrag;
+    static const Attributes noUniforms;
+    const FragmentShader & shader = (frag != NULL) ? *frag : defaultFrag;
+    const Attributes & unis = (uniforms != NULL) ? *uniforms : noUniforms;
+
+    // Per-sample edge and depth offsets from the pixel corner
+    int samples = target.sampleCount();
+    REAL sampleEdge[8][3];
+    REAL sampleDepth[8];
+    for(int s = 0; s < samples; s++)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            sampleEdge[s][i] = tri.A[i] * target.sampleX(s) + tri.B[i] * target.sampleY(s);
+        }
+        sampleDepth[s] = tri.zA * target.sampleX(s) + tri.zB * target.sampleY(s);
+    }
+
+    unsigned int fullMask = (1u << samples) - 1;
+    for(int y = tri.minY; y <= tri.maxY; y++)
+    {
+        REAL zRow = tri.depthRow((REAL)y);
+        for(int x = tri.minX; x <= tri.maxX; x++)
+        {
+            REAL corner[3];
+            tri.evaluate(corner, (REAL)x, (REAL)y);
+            REAL zCorner = tri.depth((REAL)x, zRow);
+
+            // Coverage and depth per sample
+            float* depth = target.depthSamples(x, y);
+            unsigned int mask = 0;
+            for(int s = 0; s < samples; s++)
+            {
+                REAL e[3] = { corner[0] + sampleEdge[s][0],
+                                corner[1] + sampleEdge[s][1],
+                                corner[2] + sampleEdge[s][2] };
+                if(!tri.covers(e))
+                {
+                    continue;
+                }
+                float z = (float)(zCorner + sampleDepth[s]);
+                if(DepthPasses(z, depth[s]))
+                {
+                    depth[s] = z;
+                    mask |= 1u << s;
+                }
+            }
+            if(mask == 0)
+            {
+                continue;
+            }
+
+            // Shade once at the pixel center
+            REAL center[3];
+            tri.evaluate(center, x + (REAL)0.5, y + (REAL)0.5);
+            Attributes fragAttr = InterpolateAttributes(attrs, center[0] * tri.invArea, center[1] * tri.invArea, center[2] * tri.invArea);
+            PIXEL fragment = 0;
+            shader.FragShader(fragment, fragAttr, unis);
+
+            PIXEL* color = target.colorSamples(x, y);
+            for(int s = 0; s < samples; s++)
+            {
+                if(mask & (1u << s))
+                {
+                    color[s] = fragment;
+                }
+            }
+            if(mask != fullMask)
+            {
+                target.markComplex(x, y);
+            }
+        }
+    }
+}
+
+/****************************************
+ * DRAW_PRIMITIVE (MSAA)
+ * Multisampled counterpart of the main
+ * drawing function.
+ ***************************************/
+void DrawPrimitive(PRIMITIVES prim,
+                   MSAABuffer& target,
+                   const Vertex inputVerts[],
+                   const Attributes inputAttrs[],
+                   Attributes* const uniforms = NULL,
+                   FragmentShader* const frag = NULL,
+                   VertexShader* const vert = NULL);
+
+#endif
@@ -1,5 +1,18 @@
 #include "definitions.h"
 #include "coursefunctions.h"
+#include "rasterizer.h"
+#include "msaa.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "scene.h"
+#include "workerpool.h"
+#include "commandbuffer.h"
+#include "dirtyregion.h"
+#include "capture.h"
+#include "depthpass.h"
+#include "instancing.h"
+#include "resolution.h"
+#include "trace.h"
 
 /***********************************************
  * CLEAR_SCREEN
@@ -7,6 +20,7 @@
  **********************************************/
 void clearScreen(Buffer2D<PIXEL> & frame, PIXEL color = 0xff000000)
 {
+    TRACE_SCOPE("clear");
     int h = frame.height();
     int w = frame.width();
     for(int y = 0; y < h; y++)
@@ -24,18 +38,43 @@ void clearScreen(Buffer2D<PIXEL> & frame, PIXEL color = 0xff000000)
  ***********************************************************/
 void SendFrame(SDL_Texture* GPU_OUTPUT, SDL_Renderer * ren, SDL_Surface* frameBuf) 
 {
+    TRACE_SCOPE("SendFrame");
     SDL_UpdateTexture(GPU_OUTPUT, NULL, frameBuf->pixels, frameBuf->pitch);
     SDL_RenderClear(ren);
     SDL_RenderCopy(ren, GPU_OUTPUT, NULL, NULL);
     SDL_RenderPresent(ren);
 }
 
+/************************************************************
+ * UPDATE_SCREEN (DIRTY RECTANGLES)
+ * Uploads only the given rectangles of the frame, then 
+ * presents. Rectangles are in Buffer2D rows, which run 
+ * bottom-up in the surface (see BufferImage).
+ ***********************************************************/
+void SendFrame(SDL_Texture* GPU_OUTPUT, SDL_Renderer * ren, SDL_Surface* frameBuf, const std::vector<SDL_Rect> & rects) 
+{
+    TRACE_SCOPE("SendFrame");
+    for(size_t i = 0; i < rects.size(); i++)
+    {
+        SDL_Rect r = rects[i];
+        r.y = frameBuf->h - (r.y + r.h);
+        Uint8* pixels = (Uint8*)frameBuf->pixels + r.y * frameBuf->pitch + r.x * sizeof(PIXEL);
+        SDL_UpdateTexture(GPU_OUTPUT, &r, pixels, frameBuf->pitch);
+    }
+    SDL_RenderClear(ren);
+    SDL_RenderCopy(ren, GPU_OUTPUT, NULL, NULL);
+    SDL_RenderPresent(ren);
+}
+
 /*************************************************************
  * POLL_CONTROLS
  * Updates the state of the application based on:
  * keyboard, mouse, touch screen, gamepad inputs. 
+ * 'toggleCapture' (if given) is set when 'c' is pressed,
+ * 'exposed' (if given) when the window contents were lost
+ * and the whole frame must be presented again.
  ************************************************************/
-void processUserInputs(bool & running)
+void processUserInputs(bool & running, bool* toggleCapture = NULL, bool* exposed = NULL)
 {
     SDL_Event e;
     int mouseX;
@@ -50,6 +89,28 @@ void processUserInputs(bool & running)
         {
             running = false;
         }
+
+        // Start a trace, or stop it and write the frames since (PIPELINE_TRACE builds)
+        if(e.key.keysym.sym == 't' && e.type == SDL_KEYDOWN) 
+        {
+            TRACE_TOGGLE("trace.json");
+        }
+
+        // Start or stop streaming frames to capture.y4m
+        if(e.key.keysym.sym == 'c' && e.type == SDL_KEYDOWN && toggleCapture != NULL) 
+        {
+            *toggleCapture = !*toggleCapture;
+        }
+
+        // Uncovered, restored or resized
+        if(e.type == SDL_WINDOWEVENT && exposed != NULL)
+        {
+            Uint8 change = e.window.event;
+            if(change == SDL_WINDOWEVENT_EXPOSED || change == SDL_WINDOWEVENT_SIZE_CHANGED || change == SDL_WINDOWEVENT_RESTORED)
+            {
+                *exposed = true;
+            }
+        }
     }
 }
 
@@ -60,6 +121,8 @@ void processUserInputs(bool & running)
  ***************************************/
 void DrawPoint(Buffer2D<PIXEL> & target, Vertex* v, Attributes* attrs, Attributes * const uniforms, FragmentShader* const frag)
 {
+    TRACE_SCOPE("DrawPoint");
+
     // Your code goes here
 }
 
@@ -69,17 +132,60 @@ void DrawPoint(Buffer2D<PIXEL> & target, Vertex* v, Attributes* attrs, Attribute
  ***************************************/
 void DrawLine(Buffer2D<PIXEL> & target, Vertex* const triangle, Attributes* const attrs, Attributes* const uniforms, FragmentShader* const frag)
 {
+    TRACE_SCOPE("DrawLine");
+
     // Your code goes here
 }
 
 /*************************************************************
  * DRAW_TRIANGLE
  * Renders a triangle to the target buffer. Essential 
- * building block for most of drawing.
+ * building block for most of drawing. Samples each pixel
+ * once at its center, see DrawTriangleMSAA for coverage
+ * based anti-aliasing.
  ************************************************************/
-void DrawTriangle(Buffer2D<PIXEL> & target, Vertex* const triangle, Attributes* const attrs, Attributes* const uniforms, FragmentShader* const frag)
+void DrawTriangle(Buffer2D<PIXEL> & target, Vertex* const triangle, Attributes* const attrs, Attributes* const uniforms, FragmentShader* const frag, Buffer2D<DEPTH>* zBuf = NULL)
 {
-    // Your code goes here
+    TRACE_SCOPE("DrawTriangle");
+    TriangleSetup tri;
+    if(!tri.setup(triangle, target.width(), target.height()))
+    {
+        return;
+    }
+
+    static const FragmentShader defaultFrag;
+    static const Attributes noUniforms;
+    const FragmentShader & shader = (frag != NULL) ? *frag : defaultFrag;
+    const Attributes & unis = (uniforms != NULL) ? *uniforms : noUniforms;
+
+    for(int y = tri.minY; y <= tri.maxY; y++)
+    {
+        REAL py = y + (REAL)0.5;
+        REAL zRow = tri.depthRow(py);
+        for(int x = tri.minX; x <= tri.maxX; x++)
+        {
+            REAL e[3];
+            tri.evaluate(e, x + (REAL)0.5, py);
+            if(!tri.covers(e))
+            {
+                continue;
+            }
+
+            // Depth test, see RasterDepthTest
+            if(zBuf != NULL)
+            {
+                DEPTH z = tri.depth(x + (REAL)0.5, zRow);
+                if(!DepthPasses(z, (*zBuf)[y][x]))
+                {
+                    continue;
+                }
+                (*zBuf)[y][x] = z;
+            }
+
+            Attributes fragAttr = InterpolateAttributes(attrs, e[0] * tri.invArea, e[1] * tri.invArea, e[2] * tri.invArea);
+            shader.FragShader(target[y][x], fragAttr, unis);
+        }
+    }
 }
 
 /**************************************************************
@@ -90,6 +196,8 @@ void DrawTriangle(Buffer2D<PIXEL> & target, Vertex* const triangle, Attributes*
 void VertexShaderExecuteVertices(const VertexShader* vert, Vertex const inputVerts[], Attributes const inputAttrs[], const int& numIn, 
                                  Attributes* const uniforms, Vertex transformedVerts[], Attributes transformedAttrs[])
 {
+    TRACE_SCOPE("vertex");
+
     // Defaults to pass-through behavior
     if(vert == NULL)
     {
@@ -98,6 +206,36 @@ void VertexShaderExecuteVertices(const VertexShader* vert, Vertex const inputVer
             transformedVerts[i] = inputVerts[i];
             transformedAttrs[i] = inputAttrs[i];
         }
+        return;
+    }
+
+    // Matrix shaders run the batch kernel over SoA positions
+    if(vert->transform != NULL)
+    {
+        alignas(32) REAL soa[4][SIMD_PAD(MAX_VERTICES)] = {};
+        for(int i = 0; i < numIn; i++)
+        {
+            soa[0][i] = inputVerts[i].x;
+            soa[1][i] = inputVerts[i].y;
+            soa[2][i] = inputVerts[i].z;
+            soa[3][i] = inputVerts[i].w;
+            transformedAttrs[i] = inputAttrs[i];
+        }
+        TransformVerticesSoA(*vert->transform, soa[0], soa[1], soa[2], soa[3], soa[0], soa[1], soa[2], soa[3], SIMD_PAD(numIn));
+        for(int i = 0; i < numIn; i++)
+        {
+            Vertex v = {soa[0][i], soa[1][i], soa[2][i], soa[3][i]};
+            transformedVerts[i] = v;
+        }
+        return;
+    }
+
+    // Programmer callback, one vertex at a time
+    static const Attributes noUniforms;
+    const Attributes & unis = (uniforms != NULL) ? *uniforms : noUniforms;
+    for(int i = 0; i < numIn; i++)
+    {
+        vert->VertShader(transformedVerts[i], transformedAttrs[i], inputVerts[i], inputAttrs[i], unis);
     }
 }
 
@@ -117,8 +255,11 @@ void DrawPrimitive(PRIMITIVES prim,
                    Attributes* const uniforms,
                    FragmentShader* const frag,                   
                    VertexShader* const vert,
-                   Buffer2D<double>* zBuf)
+                   Buffer2D<DEPTH>* zBuf)
 {
+    // Primitive assembly (and clipping, once implemented) is this event's own time
+    TRACE_SCOPE("DrawPrimitive");
+
     // Setup count for vertices & attributes
     int numIn = 0;
     switch(prim)
@@ -149,15 +290,58 @@ void DrawPrimitive(PRIMITIVES prim,
             DrawLine(target, transformedVerts, transformedAttrs, uniforms, frag);
             break;
         case TRIANGLE:
-            DrawTriangle(target, transformedVerts, transformedAttrs, uniforms, frag);
+            DrawTriangle(target, transformedVerts, transformedAttrs, uniforms, frag, zBuf);
+    }
+}
+
+/***************************************************************************
+ * DRAW_PRIMITIVE (MSAA)
+ * Same stages as above into a multisampled target. Depth is kept per
+ * sample inside the target itself. Only triangles carry coverage, points
+ * and lines are not rasterized into multisampled targets.
+ **************************************************************************/
+void DrawPrimitive(PRIMITIVES prim, 
+                   MSAABuffer& target,
+                   const Vertex inputVerts[], 
+                   const Attributes inputAttrs[],
+                   Attributes* const uniforms,
+                   FragmentShader* const frag,                   
+                   VertexShader* const vert)
+{
+    TRACE_SCOPE("DrawPrimitive");
+    if(prim != TRIANGLE)
+    {
+        return;
     }
+
+    // Vertex shader 
+    Vertex transformedVerts[MAX_VERTICES];
+    Attributes transformedAttrs[MAX_VERTICES];
+    VertexShaderExecuteVertices(vert, inputVerts, inputAttrs, 3, uniforms, transformedVerts, transformedAttrs);
+
+    // Coverage, per-sample depth & shade-once fragment drawing
+    DrawTriangleMSAA(target, transformedVerts, transformedAttrs, uniforms, frag);
+}
+
+/*************************************************************
+ * DRAW_FRAME:
+ * Records every draw of the frame into 'frame' (see
+ * CommandBuffer), which is then shaded once and replayed
+ * into each dirty region, or into the whole scaled target
+ * with dynamic resolution. Size viewports from 'width' and
+ * 'height', the size of the target the draws will land in.
+ ************************************************************/
+void DrawFrame(CommandBuffer & frame, const int & width, const int & height, void* context)
+{
+    // Your code goes here
 }
 
 /*************************************************************
  * MAIN:
- * Main game loop, initialization, memory management
+ * Main game loop, initialization, memory management.
+ * Usage: pipeline [width height [frame budget in ms]]
  ************************************************************/
-int main()
+int main(int argc, char** argv)
 {
     // -----------------------DATA TYPES----------------------
     SDL_Window* WIN;               // Our Window
@@ -165,32 +349,120 @@ int main()
     SDL_Texture* GPU_OUTPUT;       // GPU buffer image (GPU Memory)
     SDL_Surface* FRAME_BUF;        // CPU buffer image (Main Memory) 
 
+    // Window size and dynamic resolution budget, S_WIDTH x S_HEIGHT by default
+    int width = (argc > 2) ? MAX(1, atoi(argv[1])) : S_WIDTH;
+    int height = (argc > 2) ? MAX(1, atoi(argv[2])) : S_HEIGHT;
+    double budgetMs = (argc > 3) ? atof(argv[3]) : 0;
+
     // ------------------------INITIALIZATION-------------------
     SDL_Init(SDL_INIT_EVERYTHING);
-    WIN = SDL_CreateWindow(WINDOW_NAME, 200, 200, S_WIDTH, S_HEIGHT, 0);
+    WIN = SDL_CreateWindow(WINDOW_NAME, 200, 200, width, height, 0);
     REN = SDL_CreateRenderer(WIN, -1, SDL_RENDERER_SOFTWARE);
-    FRAME_BUF = SDL_CreateRGBSurface(0, S_WIDTH, S_HEIGHT, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+    FRAME_BUF = SDL_CreateRGBSurface(0, width, height, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
     FRAME_BUF = SDL_ConvertSurface(SDL_GetWindowSurface(WIN), SDL_GetWindowSurface(WIN)->format, 0);
     GPU_OUTPUT = SDL_CreateTextureFromSurface(REN, FRAME_BUF);
     BufferImage frame(FRAME_BUF);
 
+    // Everything is drawn once, afterwards only what is marked
+    DirtyTracker dirty(width, height);
+    dirty.markAll();
+
+    // Scales the internal target to hold the budget, if one was given
+    DynamicResolution resolution(width, height, budgetMs);
+
+    // Presented frames are streamed while capturing
+    FrameCapture* capture = NULL;
+
+    // The frame's draws, recorded by DrawFrame and replayed by the queue
+    CommandBuffer frameCommands;
+    CommandQueue queue;
+
     // Draw loop 
+    TRACE_THREAD_NAME("main");
     bool running = true;
     while(running) 
     {           
+        TRACE_NEXT_FRAME();
+        TRACE_SCOPE("frame");
+
         // Handle user inputs
-        processUserInputs(running);
+        bool toggleCapture = false;
+        bool exposed = false;
+        processUserInputs(running, &toggleCapture, &exposed);
+        if(exposed)
+        {
+            dirty.markAll();
+        }
+        if(toggleCapture)
+        {
+            if(capture != NULL)
+            {
+                delete capture;
+                capture = NULL;
+            }
+            else
+            {
+                capture = new FrameCapture("capture.y4m", width, height);
+                if(!capture->valid())
+                {
+                    fprintf(stderr, "Could not open capture.y4m for writing\n");
+                    delete capture;
+                    capture = NULL;
+                }
+            }
+        }
 
-        // Refresh Screen
-        clearScreen(frame);
+        // Full redraw at the internal resolution, upscaled to the window
+        if(resolution.enabled())
+        {
+            // Times the previous frame, its present included
+            resolution.beginFrame();
+            {
+                PooledTarget<PIXEL> internal = resolution.acquire();
+                frameCommands.reset();
+                DrawFrame(frameCommands, internal->width(), internal->height(), NULL);
+                clearScreen(*internal);
+                queue.submit(*internal, frameCommands);
+                resolution.present(*internal, frame);
+            }
+            if(capture != NULL)
+            {
+                capture->capture(frame);
+            }
+            SendFrame(GPU_OUTPUT, REN, FRAME_BUF);
+            continue;
+        }
 
-        // Your code goes here
+        // Your code goes here: mark changed regions of 'dirty'
+        // (markObject, markRect, or markAll for animations)
 
-        // Push to the GPU
-        SendFrame(GPU_OUTPUT, REN, FRAME_BUF);
+        // Idle frames sleep until the next event, or repeat the frame while capturing
+        if(!dirty.any())
+        {
+            if(capture != NULL)
+            {
+                capture->capture(frame);
+            }
+            SDL_WaitEventTimeout(NULL, (capture != NULL) ? 1000 / CAPTURE_FPS : IDLE_WAIT_MS);
+            continue;
+        }
+
+        // Record the frame once, then redraw it into the dirty regions of the screen
+        frameCommands.reset();
+        DrawFrame(frameCommands, width, height, NULL);
+        RenderDirtyRegions(frame, dirty, queue, frameCommands);
+
+        // Push the dirty regions to the GPU
+        if(capture != NULL)
+        {
+            capture->capture(frame);
+        }
+        SendFrame(GPU_OUTPUT, REN, FRAME_BUF, dirty.dirtyRects());
+        dirty.clear();
     }
 
     // Cleanup
+    delete capture;
     SDL_FreeSurface(FRAME_BUF);
     SDL_DestroyTexture(GPU_OUTPUT);
     SDL_DestroyRenderer(REN);
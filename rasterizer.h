@@ -0,0 +1,190 @@
+#include "definitions.h"
+
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+/****************************************************
+ * SCISSOR:
+ * Optional per-thread clip rectangle (inclusive)
+ * honored by the rasterizers, used to split a frame
+ * into bands that threads rasterize independently.
+ ***************************************************/
+struct Scissor
+{
+    bool enabled;
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+inline Scissor & RasterScissor()
+{
+    static thread_local Scissor scissor = {false, 0, 0, 0, 0};
+    return scissor;
+}
+
+/****************************************************
+ * DEPTH_TEST:
+ * Comparison of a fragment's depth against the
+ * stored one, per thread like the scissor. LESS is
+ * the default. After a Z-prepass shade with
+ * LESS_EQUAL or EQUAL so fragments pass against
+ * their own depth. DepthPasses works on any stored
+ * depth type, DEPTH or MSAA's float samples.
+ ***************************************************/
+enum DEPTH_TEST
+{
+    DEPTH_LESS,
+    DEPTH_LESS_EQUAL,
+    DEPTH_EQUAL
+};
+
+inline DEPTH_TEST & RasterDepthTest()
+{
+    static thread_local DEPTH_TEST test = DEPTH_LESS;
+    return test;
+}
+
+template <class T>
+inline bool DepthPasses(const T & z, const T & stored)
+{
+    switch(RasterDepthTest())
+    {
+        case DEPTH_LESS_EQUAL:
+            return !(stored < z);
+        case DEPTH_EQUAL:
+            return !(stored < z) && !(z < stored);
+        default:
+            return z < stored;
+    }
+}
+
+/****************************************************
+ * TRIANGLE_SETUP:
+ * Edge functions shared by the single sample and
+ * multisample triangle rasterizers. Edge 'i' lies
+ * opposite vertex 'i' and is stored in the form
+ *      E_i(x,y) = A[i]*x + B[i]*y + C[i]
+ * normalized so that the interior is positive for
+ * either winding. E_i / area is the barycentric
+ * weight of vertex 'i'. Depth is the plane
+ *      z(x,y) = zA*x + (zB*y + zC)
+ * evaluated the same way by every rasterizer, so a
+ * depth-only pass and a shading pass agree exactly
+ * (as long as the compiler may not reassociate, i.e.
+ * no -ffast-math).
+ * Templated on the scalar of the pipeline, see REAL.
+ ***************************************************/
+template <class T>
+struct TTriangleSetup
+{
+    T A[3];
+    T B[3];
+    T C[3];
+    bool topLeft[3];
+    T invArea;
+    T zA;
+    T zB;
+    T zC;
+    int minX;
+    int maxX;
+    int minY;
+    int maxY;
+
+    // Builds the edges and the clamped bounding box, false if nothing can be covered
+    bool setup(const TVertex<T>* const tri, const int & w, const int & h)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            const TVertex<T> & a = tri[(i + 1) % 3];
+            const TVertex<T> & b = tri[(i + 2) % 3];
+            A[i] = a.y - b.y;
+            B[i] = b.x - a.x;
+            C[i] = -(A[i] * a.x + B[i] * a.y);
+        }
+
+        T area = A[0] * tri[0].x + B[0] * tri[0].y + C[0];
+        if(area == 0)
+        {
+            return false;
+        }
+        if(area < 0)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                A[i] = -A[i];
+                B[i] = -B[i];
+                C[i] = -C[i];
+            }
+            area = -area;
+        }
+        invArea = 1 / area;
+
+        // Depth plane from the barycentric weights
+        zA = 0;
+        zB = 0;
+        zC = 0;
+        for(int i = 0; i < 3; i++)
+        {
+            T zi = tri[i].z * invArea;
+            zA += A[i] * zi;
+            zB += B[i] * zi;
+            zC += C[i] * zi;
+        }
+
+        // Ties on shared edges go to the top/left triangle only
+        for(int i = 0; i < 3; i++)
+        {
+            topLeft[i] = (A[i] > 0) || (A[i] == 0 && B[i] > 0);
+        }
+
+        minX = (int)floor(MIN3(tri[0].x, tri[1].x, tri[2].x));
+        maxX = (int)ceil(MAX3(tri[0].x, tri[1].x, tri[2].x));
+        minY = (int)floor(MIN3(tri[0].y, tri[1].y, tri[2].y));
+        maxY = (int)ceil(MAX3(tri[0].y, tri[1].y, tri[2].y));
+        minX = MAX(minX, 0);
+        minY = MAX(minY, 0);
+        maxX = MIN(maxX, w - 1);
+        maxY = MIN(maxY, h - 1);
+
+        const Scissor & scissor = RasterScissor();
+        if(scissor.enabled)
+        {
+            minX = MAX(minX, scissor.minX);
+            minY = MAX(minY, scissor.minY);
+            maxX = MIN(maxX, scissor.maxX);
+            maxY = MIN(maxY, scissor.maxY);
+        }
+        return minX <= maxX && minY <= maxY;
+    }
+
+    // Evaluate all three edges at a point
+    inline void evaluate(T e[3], const T & x, const T & y) const
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            e[i] = A[i] * x + (B[i] * y + C[i]);
+        }
+    }
+
+    // Depth on a row: 'row' is depthRow(y), then depth(x, row) per pixel
+    inline T depthRow(const T & y) const       { return zB * y + zC; }
+    inline T depth(const T & x, const T & row) const { return zA * x + row; }
+
+    // Coverage test with the top-left fill rule
+    inline bool covers(const T e[3]) const
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            if(e[i] < 0 || (e[i] == 0 && !topLeft[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+typedef TTriangleSetup<REAL> TriangleSetup;
+
+#endif
@@ -0,0 +1,255 @@
+#include "definitions.h"
+#include "targetpool.h"
+#include <vector>
+#include <chrono>
+
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+/******************************************************
+ * DEFINES:
+ * Dynamic resolution limits. Scales are quantized to
+ * RES_SCALE_STEP so the target pool only ever holds
+ * a handful of sizes, and the scale only grows after
+ * RES_GROW_FRAMES consecutive frames well under budget.
+ *****************************************************/
+#define RES_MIN_SCALE   0.25
+#define RES_SCALE_STEP  0.0625
+#define RES_GROW_FRAMES 30
+#define RES_GROW_BELOW  0.75
+#define RES_SHRINK_ABOVE 0.95
+
+/****************************************************
+ * BILINEAR_COLUMNS:
+ * Source column pair and 8-bit weight of every
+ * destination column of a BlitBilinear, rebuilt only
+ * when the source or destination width changes.
+ ***************************************************/
+struct BilinearColumns
+{
+    int srcW;
+    int dstW;
+    std::vector<int> x0;
+    std::vector<int> x1;
+    std::vector<Uint32> fx;
+
+    BilinearColumns()
+    {
+        srcW = 0;
+        dstW = 0;
+    }
+
+    // Centers aligned, fixed point 16.16
+    void update(const int & sw, const int & dw)
+    {
+        if(sw == srcW && dw == dstW)
+        {
+            return;
+        }
+        srcW = sw;
+        dstW = dw;
+        x0.resize(dw);
+        x1.resize(dw);
+        fx.resize(dw);
+        Sint64 stepX = ((Sint64)sw << 16) / dw;
+        Sint64 sx = stepX / 2 - 0x8000;
+        for(int x = 0; x < dw; x++, sx += stepX)
+        {
+            Sint64 clamped = MAX(sx, (Sint64)0);
+            x0[x] = MIN((int)(clamped >> 16), sw - 1);
+            x1[x] = MIN(x0[x] + 1, sw - 1);
+            fx[x] = (Uint32)((clamped >> 8) & 0xff);
+        }
+    }
+};
+
+/****************************************************
+ * BLIT_BILINEAR
+ * Scales all of 'src' into all of 'dst' with
+ * bilinear filtering. Sample positions are fixed
+ * point and precomputed per column in 'columns',
+ * which callers keep across frames. Channels are
+ * blended two at a time in 32-bit integers (8-bit
+ * weights). Equal sizes are copied row by row.
+ ***************************************************/
+void BlitBilinear(const Buffer2D<PIXEL> & src, Buffer2D<PIXEL> & dst, BilinearColumns & columns)
+{
+    int sw = src.width();
+    int sh = src.height();
+    int dw = dst.width();
+    int dh = dst.height();
+    if(sw == dw && sh == dh)
+    {
+        for(int y = 0; y < dh; y++)
+        {
+            memcpy(dst[y], src[y], sizeof(PIXEL) * dw);
+        }
+        return;
+    }
+
+    columns.update(sw, dw);
+    const int* x0 = &columns.x0[0];
+    const int* x1 = &columns.x1[0];
+    const Uint32* fx = &columns.fx[0];
+
+    Sint64 stepY = ((Sint64)sh << 16) / dh;
+    Sint64 sy = stepY / 2 - 0x8000;
+    for(int y = 0; y < dh; y++, sy += stepY)
+    {
+        Sint64 clamped = MAX(sy, (Sint64)0);
+        int y0 = MIN((int)(clamped >> 16), sh - 1);
+        int y1 = MIN(y0 + 1, sh - 1);
+        Uint32 fy = (Uint32)((clamped >> 8) & 0xff);
+        const PIXEL* top = src[y0];
+        const PIXEL* bottom = src[y1];
+        PIXEL* out = dst[y];
+        for(int x = 0; x < dw; x++)
+        {
+            PIXEL a = top[x0[x]];
+            PIXEL b = top[x1[x]];
+            PIXEL c = bottom[x0[x]];
+            PIXEL d = bottom[x1[x]];
+            Uint32 f = fx[x];
+            Uint32 g = 256 - f;
+
+            // Horizontal blends of the two rows, red/blue and alpha/green halves
+            Uint32 rbTop = (((a & 0x00ff00ff) * g + (b & 0x00ff00ff) * f) >> 8) & 0x00ff00ff;
+            Uint32 agTop = (((((a >> 8) & 0x00ff00ff) * g + ((b >> 8) & 0x00ff00ff) * f)) >> 8) & 0x00ff00ff;
+            Uint32 rbBottom = (((c & 0x00ff00ff) * g + (d & 0x00ff00ff) * f) >> 8) & 0x00ff00ff;
+            Uint32 agBottom = (((((c >> 8) & 0x00ff00ff) * g + ((d >> 8) & 0x00ff00ff) * f)) >> 8) & 0x00ff00ff;
+
+            // Vertical blend
+            Uint32 rb = ((rbTop * (256 - fy) + rbBottom * fy) >> 8) & 0x00ff00ff;
+            Uint32 ag = (agTop * (256 - fy) + agBottom * fy) & 0xff00ff00;
+            out[x] = rb | ag;
+        }
+    }
+}
+
+// One-off blit, builds its column table on every call
+void BlitBilinear(const Buffer2D<PIXEL> & src, Buffer2D<PIXEL> & dst)
+{
+    BilinearColumns columns;
+    BlitBilinear(src, dst, columns);
+}
+
+/****************************************************
+ * DYNAMIC_RESOLUTION:
+ * Picks the internal render resolution that keeps
+ * frame time within 'budgetMs'. Frames are timed
+ * start to start, so presenting and waiting on
+ * vsync count against the budget. Over budget the
+ * scale drops at once, in proportion to the
+ * measured time (pixel cost grows with the square
+ * of the scale). Under budget it grows one step at
+ * a time after RES_GROW_FRAMES frames. A budget of
+ * 0 disables scaling. Internal targets come from the
+ * shared TargetPool, idle targets of other sizes are
+ * freed whenever the scale changes. present() keeps
+ * the upscale's column table across frames.
+ ***************************************************/
+class DynamicResolution
+{
+    protected:
+        int outW;
+        int outH;
+        double budget;
+        double scaleFactor;
+        double lastMs;
+        int calmFrames;
+        bool timing;
+        BilinearColumns columns;
+        std::chrono::steady_clock::time_point start;
+
+        static double quantize(const double & s)
+        {
+            double q = floor(s / RES_SCALE_STEP) * RES_SCALE_STEP;
+            return (q < RES_MIN_SCALE) ? RES_MIN_SCALE : ((q > 1) ? 1 : q);
+        }
+
+    public:
+        DynamicResolution(const int & wid, const int & hgt, const double & budgetMs = 0)
+        {
+            outW = wid;
+            outH = hgt;
+            budget = budgetMs;
+            scaleFactor = 1;
+            lastMs = 0;
+            calmFrames = 0;
+            timing = false;
+        }
+
+        bool enabled() { return budget > 0; }
+        void setBudget(const double & budgetMs) { budget = budgetMs; }
+
+        // Change the presented size, e.g. after a window resize
+        void setOutputSize(const int & wid, const int & hgt)
+        {
+            outW = wid;
+            outH = hgt;
+        }
+
+        double scale()   { return scaleFactor; }
+        double frameMs() { return lastMs; }
+        int width()      { return MAX(1, (int)(outW * scaleFactor + 0.5)); }
+        int height()     { return MAX(1, (int)(outH * scaleFactor + 0.5)); }
+
+        // Call at the start of every frame, times the previous one and picks this one's scale
+        void beginFrame()
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            bool measured = timing;
+            if(measured)
+            {
+                lastMs = std::chrono::duration<double, std::milli>(now - start).count();
+            }
+            start = now;
+            timing = true;
+            if(!measured || budget <= 0 || lastMs <= 0)
+            {
+                return;
+            }
+
+            double previous = scaleFactor;
+
+            if(lastMs > budget * RES_SHRINK_ABOVE)
+            {
+                // Drop pixels rather than frames
+                double next = quantize(scaleFactor * sqrt(budget * RES_SHRINK_ABOVE / lastMs));
+                scaleFactor = (next < scaleFactor) ? next : quantize(scaleFactor - RES_SCALE_STEP);
+                calmFrames = 0;
+            }
+            else if(lastMs < budget * RES_GROW_BELOW && scaleFactor < 1)
+            {
+                if(++calmFrames >= RES_GROW_FRAMES)
+                {
+                    scaleFactor = quantize(scaleFactor + RES_SCALE_STEP);
+                    calmFrames = 0;
+                }
+            }
+            else
+            {
+                calmFrames = 0;
+            }
+
+            // Targets of the old size would otherwise stay pooled for good
+            if(scaleFactor != previous)
+            {
+                TargetPool<PIXEL>().trim(width(), height());
+            }
+        }
+
+        // Internal target for this frame, release it once presented
+        PooledTarget<PIXEL> acquire()
+        {
+            return PooledTarget<PIXEL>(width(), height());
+        }
+
+        // Upscale the internal target to the output
+        void present(const Buffer2D<PIXEL> & internal, Buffer2D<PIXEL> & out)
+        {
+            BlitBilinear(internal, out, columns);
+        }
+};
+
+#endif
@@ -0,0 +1,588 @@
+#include "definitions.h"
+#include "matrix.h"
+#include "mesh.h"
+#include <vector>
+#include <algorithm>
+
+#ifndef SCENE_H
+#define SCENE_H
+
+/******************************************************
+ * DEFINES:
+ * Most objects referenced by a single BVH leaf.
+ *****************************************************/
+#define BVH_LEAF_SIZE 4
+
+/****************************************************
+ * BOUNDING VOLUMES:
+ * Axis aligned box and sphere in a common space.
+ ***************************************************/
+struct BoundingSphere
+{
+    Vec4 center;
+    REAL radius;
+};
+
+struct AABB
+{
+    Vec4 lo;
+    Vec4 hi;
+
+    AABB()
+    {
+        lo = Vec4(FLT_MAX, FLT_MAX, FLT_MAX);
+        hi = Vec4(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    }
+
+    bool empty() const { return lo.x > hi.x; }
+
+    void grow(const REAL & x, const REAL & y, const REAL & z)
+    {
+        lo.x = MIN(lo.x, x);
+        lo.y = MIN(lo.y, y);
+        lo.z = MIN(lo.z, z);
+        hi.x = MAX(hi.x, x);
+        hi.y = MAX(hi.y, y);
+        hi.z = MAX(hi.z, z);
+    }
+
+    void grow(const AABB & box)
+    {
+        if(!box.empty())
+        {
+            grow(box.lo.x, box.lo.y, box.lo.z);
+            grow(box.hi.x, box.hi.y, box.hi.z);
+        }
+    }
+
+    Vec4 center() const { return Vec4((lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2); }
+    Vec4 extent() const { return Vec4((hi.x - lo.x) / 2, (hi.y - lo.y) / 2, (hi.z - lo.z) / 2, 0); }
+
+    // Box around this box after 'mat' (Arvo's method, affine matrices)
+    AABB transformed(const Matrix4 & mat) const
+    {
+        if(empty())
+        {
+            return *this;
+        }
+        Vec4 c = mat * center();
+        Vec4 e = extent();
+        REAL half[3];
+        for(int r = 0; r < 3; r++)
+        {
+            half[r] = fabs(mat.at(r, 0)) * e.x + fabs(mat.at(r, 1)) * e.y + fabs(mat.at(r, 2)) * e.z;
+        }
+        AABB out;
+        out.grow(c.x - half[0], c.y - half[1], c.z - half[2]);
+        out.grow(c.x + half[0], c.y + half[1], c.z + half[2]);
+        return out;
+    }
+
+    BoundingSphere sphere() const
+    {
+        BoundingSphere s;
+        s.center = center();
+        s.radius = sqrt(extent().dot3(extent()));
+        return s;
+    }
+};
+
+// Local space bounds of every vertex referenced by a mesh
+AABB ComputeMeshBounds(Mesh & mesh)
+{
+    AABB box;
+    for(int i = 0; i < mesh.numVertices; i++)
+    {
+        box.grow(mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z);
+    }
+    return box;
+}
+
+/****************************************************
+ * CAMERA:
+ * The TestPipeline camera variables plus a
+ * projection. Angles are in radians, applied as
+ * roll (z), then pitch (x), then yaw (y).
+ ***************************************************/
+struct Camera
+{
+    REAL yaw;
+    REAL pitch;
+    REAL roll;
+    REAL x;
+    REAL y;
+    REAL z;
+    REAL fovY;
+    REAL aspect;
+    REAL nearZ;
+    REAL farZ;
+
+    Camera()
+    {
+        yaw = pitch = roll = 0;
+        x = y = z = 0;
+        fovY = (REAL)1.04719755;     // 60 degrees
+        aspect = 1;
+        nearZ = 1;
+        farZ = 1000;
+    }
+
+    // World to camera space
+    Matrix4 view() const
+    {
+        return Matrix4::rotateZ(-roll) * Matrix4::rotateX(-pitch) * Matrix4::rotateY(-yaw) * Matrix4::translate(-x, -y, -z);
+    }
+
+    Matrix4 projection() const
+    {
+        return Matrix4::perspective(fovY, aspect, nearZ, farZ);
+    }
+};
+
+/****************************************************
+ * FRUSTUM:
+ * Six inward facing planes (a,b,c,d in x,y,z,w)
+ * extracted from a view-projection matrix in the
+ * Matrix4 clip conventions.
+ ***************************************************/
+enum CULL_RESULT
+{
+    CULL_OUTSIDE,
+    CULL_INTERSECTS,
+    CULL_INSIDE
+};
+
+class Frustum
+{
+    public:
+        Vec4 planes[6];
+
+        Frustum() {}
+
+        Frustum(const Matrix4 & viewProj)
+        {
+            extract(viewProj);
+        }
+
+        Frustum(const Camera & cam)
+        {
+            extract(cam.projection() * cam.view());
+        }
+
+        void extract(const Matrix4 & m)
+        {
+            Vec4 row[4];
+            for(int r = 0; r < 4; r++)
+            {
+                row[r] = Vec4(m.at(r, 0), m.at(r, 1), m.at(r, 2), m.at(r, 3));
+            }
+            for(int i = 0; i < 3; i++)
+            {
+                // left/right, bottom/top use -w <= x,y <= w, near/far use 0 <= z <= w
+                const Vec4 & r = row[i];
+                planes[i * 2] = (i == 2) ? r : Vec4(row[3].x + r.x, row[3].y + r.y, row[3].z + r.z, row[3].w + r.w);
+                planes[i * 2 + 1] = Vec4(row[3].x - r.x, row[3].y - r.y, row[3].z - r.z, row[3].w - r.w);
+            }
+            for(int p = 0; p < 6; p++)
+            {
+                REAL len = sqrt(planes[p].dot3(planes[p]));
+                if(len > 0)
+                {
+                    planes[p] = Vec4(planes[p].x / len, planes[p].y / len, planes[p].z / len, planes[p].w / len);
+                }
+            }
+        }
+
+        CULL_RESULT test(const BoundingSphere & s) const
+        {
+            CULL_RESULT result = CULL_INSIDE;
+            for(int p = 0; p < 6; p++)
+            {
+                REAL dist = planes[p].dot3(s.center) + planes[p].w;
+                if(dist < -s.radius)
+                {
+                    return CULL_OUTSIDE;
+                }
+                if(dist < s.radius)
+                {
+                    result = CULL_INTERSECTS;
+                }
+            }
+            return result;
+        }
+
+        CULL_RESULT test(const AABB & box) const
+        {
+            if(box.empty())
+            {
+                return CULL_OUTSIDE;
+            }
+            Vec4 c = box.center();
+            Vec4 e = box.extent();
+            CULL_RESULT result = CULL_INSIDE;
+            for(int p = 0; p < 6; p++)
+            {
+                const Vec4 & n = planes[p];
+                REAL dist = n.dot3(c) + n.w;
+                REAL reach = fabs(n.x) * e.x + fabs(n.y) * e.y + fabs(n.z) * e.z;
+                if(dist < -reach)
+                {
+                    return CULL_OUTSIDE;
+                }
+                if(dist < reach)
+                {
+                    result = CULL_INTERSECTS;
+                }
+            }
+            return result;
+        }
+};
+
+/****************************************************
+ * SCENE_OBJECT:
+ * A mesh placed in the world with the state used to
+ * draw it. Bounds are kept in local and world space.
+ * 'vert' (optional) runs in object space ahead of
+ * the model, view and projection transforms, so it
+ * must keep positions within the mesh's bounds or
+ * culling no longer matches what is drawn.
+ ***************************************************/
+struct SceneObject
+{
+    Mesh* mesh;
+    Matrix4 model;
+    AABB localBounds;
+    AABB worldBounds;
+    BoundingSphere worldSphere;
+    const Attributes* vertAttrs;
+    Attributes* uniforms;
+    FragmentShader* frag;
+    VertexShader* vert;
+
+    void updateWorldBounds()
+    {
+        worldBounds = localBounds.transformed(model);
+        worldSphere = worldBounds.sphere();
+    }
+};
+
+/****************************************************
+ * BVH_NODE:
+ * Interior nodes reference two children, leaves a
+ * range of the scene's object order. Children are
+ * always stored after their parent.
+ ***************************************************/
+struct BVHNode
+{
+    AABB bounds;
+    int left;
+    int right;
+    int first;
+    int count;
+
+    bool leaf() const { return count > 0; }
+};
+
+/****************************************************
+ * SCENE:
+ * Objects organized in a bounding volume hierarchy
+ * for frustum culling ahead of any vertex work.
+ * Adding objects rebuilds the tree, moving them only
+ * refits it.
+ ***************************************************/
+class Scene
+{
+    protected:
+        std::vector<SceneObject> objects;
+        std::vector<int> order;
+        std::vector<BVHNode> nodes;
+        bool needsBuild;
+        bool needsRefit;
+
+        // Median split on the longest axis of the centroid bounds
+        int buildNode(const int & first, const int & count)
+        {
+            int index = (int)nodes.size();
+            nodes.push_back(BVHNode());
+            BVHNode node;
+            node.left = node.right = -1;
+            node.first = first;
+            node.count = count;
+            AABB centroids;
+            for(int i = first; i < first + count; i++)
+            {
+                const SceneObject & obj = objects[order[i]];
+                node.bounds.grow(obj.worldBounds);
+                Vec4 c = obj.worldBounds.center();
+                centroids.grow(c.x, c.y, c.z);
+            }
+
+            if(count > BVH_LEAF_SIZE)
+            {
+                Vec4 size = centroids.extent();
+                int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+                int half = count / 2;
+                std::vector<SceneObject> & objs = objects;
+                std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                                 [&objs, axis](const int & a, const int & b)
+                                 {
+                                     Vec4 ca = objs[a].worldBounds.center();
+                                     Vec4 cb = objs[b].worldBounds.center();
+                                     return (axis == 0) ? ca.x < cb.x : (axis == 1 ? ca.y < cb.y : ca.z < cb.z);
+                                 });
+                node.count = 0;
+                node.left = buildNode(first, half);
+                node.right = buildNode(first + half, count - half);
+            }
+            nodes[index] = node;
+            return index;
+        }
+
+        void collect(const int & index, std::vector<int> & visible) const
+        {
+            const BVHNode & node = nodes[index];
+            if(node.leaf())
+            {
+                visible.insert(visible.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+                return;
+            }
+            collect(node.left, visible);
+            collect(node.right, visible);
+        }
+
+    public:
+        Scene()
+        {
+            needsBuild = false;
+            needsRefit = false;
+        }
+
+        // Returns the object's id, valid for the life of the scene
+        int add(Mesh* mesh, const Matrix4 & model,
+                const Attributes* vertAttrs = NULL, Attributes* uniforms = NULL,
+                FragmentShader* frag = NULL, VertexShader* vert = NULL)
+        {
+            SceneObject obj;
+            obj.mesh = mesh;
+            obj.model = model;
+            obj.localBounds = ComputeMeshBounds(*mesh);
+            obj.vertAttrs = vertAttrs;
+            obj.uniforms = uniforms;
+            obj.frag = frag;
+            obj.vert = vert;
+            obj.updateWorldBounds();
+            objects.push_back(obj);
+            needsBuild = true;
+            return (int)objects.size() - 1;
+        }
+
+        // Move an object, the tree is refit on the next cull
+        void setModel(const int & id, const Matrix4 & model)
+        {
+            objects[id].model = model;
+            objects[id].updateWorldBounds();
+            needsRefit = true;
+        }
+
+        SceneObject & object(const int & id) { return objects[id]; }
+        int size() { return (int)objects.size(); }
+
+        void build()
+        {
+            nodes.clear();
+            order.resize(objects.size());
+            for(size_t i = 0; i < order.size(); i++)
+            {
+                order[i] = (int)i;
+            }
+            if(!objects.empty())
+            {
+                nodes.reserve(objects.size() * 2);
+                buildNode(0, (int)objects.size());
+            }
+            needsBuild = false;
+            needsRefit = false;
+        }
+
+        // Recompute node bounds bottom-up, topology unchanged
+        void refit()
+        {
+            for(int n = (int)nodes.size() - 1; n >= 0; n--)
+            {
+                BVHNode & node = nodes[n];
+                node.bounds = AABB();
+                if(node.leaf())
+                {
+                    for(int i = node.first; i < node.first + node.count; i++)
+                    {
+                        node.bounds.grow(objects[order[i]].worldBounds);
+                    }
+                }
+                else
+                {
+                    node.bounds.grow(nodes[node.left].bounds);
+                    node.bounds.grow(nodes[node.right].bounds);
+                }
+            }
+            needsRefit = false;
+        }
+
+        // Ids of objects that may be visible, subtrees fully inside skip further tests
+        void cull(const Frustum & frustum, std::vector<int> & visible)
+        {
+            visible.clear();
+            if(needsBuild)
+            {
+                build();
+            }
+            else if(needsRefit)
+            {
+                refit();
+            }
+            if(nodes.empty())
+            {
+                return;
+            }
+
+            int stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            while(top > 0)
+            {
+                int index = stack[--top];
+                const BVHNode & node = nodes[index];
+                CULL_RESULT result = frustum.test(node.bounds);
+                if(result == CULL_OUTSIDE)
+                {
+                    continue;
+                }
+                if(result == CULL_INSIDE)
+                {
+                    collect(index, visible);
+                    continue;
+                }
+                if(node.leaf())
+                {
+                    for(int i = node.first; i < node.first + node.count; i++)
+                    {
+                        const SceneObject & obj = objects[order[i]];
+                        if(frustum.test(obj.worldSphere) != CULL_OUTSIDE && frustum.test(obj.worldBounds) != CULL_OUTSIDE)
+                        {
+                            visible.push_back(order[i]);
+                        }
+                    }
+                    continue;
+                }
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+};
+
+/****************************************************
+ * SCENE_SCRATCH:
+ * Per-call working storage of DrawScene. Keep one
+ * per drawing thread to avoid reallocating it every
+ * frame.
+ ***************************************************/
+struct SceneScratch
+{
+    std::vector<int> visible;
+    std::vector<Vertex> verts;          // Screen space, w = 1 / clip w
+    std::vector<Attributes> attrs;
+    std::vector<bool> behind;           // Clip w <= 0, not drawable without clipping
+    VertexArraySoA positions;           // Transform batch, grows only
+
+    SceneScratch() : positions(0) {}
+};
+
+/****************************************************
+ * DRAW_SCENE
+ * Culls against the camera and draws the surviving
+ * objects. Each object's mesh is transformed once per
+ * vertex by viewport * projection * view * model
+ * (after its own 'vert', if any) in one SoA batch,
+ * then divided by w. The viewport is affine, so
+ * applying it before the divide is the same.
+ * Triangles with a corner behind the camera are
+ * skipped until clipping is implemented. Returns the
+ * number of objects drawn.
+ ***************************************************/
+int DrawScene(Buffer2D<PIXEL>& target, Scene & scene, const Camera & cam, SceneScratch & scratch, Buffer2D<DEPTH>* zBuf = NULL)
+{
+    scene.cull(Frustum(cam), scratch.visible);
+    Matrix4 viewProj = cam.projection() * cam.view();
+    Matrix4 viewport = Matrix4::viewport(target.width(), target.height());
+    for(size_t i = 0; i < scratch.visible.size(); i++)
+    {
+        SceneObject & obj = scene.object(scratch.visible[i]);
+        Mesh & mesh = *obj.mesh;
+        Matrix4 toScreen = viewport * viewProj * obj.model;
+        scratch.verts.resize(mesh.numVertices);
+        scratch.attrs.resize(mesh.numVertices);
+        scratch.behind.resize(mesh.numVertices);
+
+        // Object space shader, a batch at a time
+        Vertex inVerts[MAX_VERTICES];
+        Attributes inAttrs[MAX_VERTICES];
+        for(int first = 0; first < mesh.numVertices; first += MAX_VERTICES)
+        {
+            int count = MIN(MAX_VERTICES, mesh.numVertices - first);
+            for(int k = 0; k < count; k++)
+            {
+                inVerts[k] = mesh.vertices[first + k];
+                inAttrs[k] = (obj.vertAttrs != NULL) ? obj.vertAttrs[first + k] : Attributes();
+            }
+            VertexShaderExecuteVertices(obj.vert, inVerts, inAttrs, count, obj.uniforms, &scratch.verts[first], &scratch.attrs[first]);
+        }
+
+        // Clip space and viewport in one batch, then normalization
+        VertexArraySoA & soa = scratch.positions;
+        soa.resize(mesh.numVertices);
+        for(int v = 0; v < mesh.numVertices; v++)
+        {
+            soa.set(v, scratch.verts[v]);
+        }
+        soa.transform(toScreen, soa);
+        for(int v = 0; v < mesh.numVertices; v++)
+        {
+            REAL w = soa.w[v];
+            scratch.behind[v] = !(w > 0);
+            if(scratch.behind[v])
+            {
+                continue;
+            }
+            REAL invW = 1 / w;
+            Vertex out = {soa.x[v] * invW, soa.y[v] * invW, soa.z[v] * invW, invW};
+            scratch.verts[v] = out;
+        }
+
+        Vertex tri[3];
+        Attributes triAttrs[3];
+        for(int t = 0; t + 2 < mesh.numIndices; t += 3)
+        {
+            bool skip = false;
+            for(int k = 0; k < 3; k++)
+            {
+                Uint32 index = mesh.indices[t + k];
+                skip = skip || scratch.behind[index];
+                tri[k] = scratch.verts[index];
+                triAttrs[k] = scratch.attrs[index];
+            }
+            if(!skip)
+            {
+                DrawPrimitive(TRIANGLE, target, tri, triAttrs, obj.uniforms, obj.frag, NULL, zBuf);
+            }
+        }
+    }
+    return (int)scratch.visible.size();
+}
+
+// Same, with scratch storage local to the call
+int DrawScene(Buffer2D<PIXEL>& target, Scene & scene, const Camera & cam, Buffer2D<DEPTH>* zBuf = NULL)
+{
+    SceneScratch scratch;
+    return DrawScene(target, scene, cam, scratch, zBuf);
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include "definitions.h"
+#include <vector>
+
+#ifndef TARGET_POOL_H
+#define TARGET_POOL_H
+
+/****************************************************
+ * RENDER_TARGET_POOL:
+ * Recycles transient Buffer2D render targets of one
+ * element type (format) by size. Once every size in
+ * use has been requested, acquire/release no longer
+ * allocate. Not thread-safe, use one pool per thread.
+ ***************************************************/
+template <class T>
+class RenderTargetPool
+{
+    protected:
+        std::vector<Buffer2D<T>*> idle;
+        int outstanding;
+
+        // Copying would double-free idle targets
+        RenderTargetPool(const RenderTargetPool &);
+        RenderTargetPool& operator=(const RenderTargetPool &);
+
+    public:
+        RenderTargetPool()
+        {
+            outstanding = 0;
+        }
+
+        ~RenderTargetPool()
+        {
+            trim();
+        }
+
+        // A target of exactly 'wid' x 'hgt', contents undefined unless 'zero'
+        Buffer2D<T>* acquire(const int & wid, const int & hgt, const bool & zero = false)
+        {
+            Buffer2D<T>* target = NULL;
+            for(size_t i = 0; i < idle.size(); i++)
+            {
+                if(idle[i]->width() == wid && idle[i]->height() == hgt)
+                {
+                    target = idle[i];
+                    idle[i] = idle.back();
+                    idle.pop_back();
+                    if(zero)
+                    {
+                        target->zeroOut();
+                    }
+                    break;
+                }
+            }
+            if(target == NULL)
+            {
+                target = new Buffer2D<T>(wid, hgt);
+            }
+            outstanding++;
+            return target;
+        }
+
+        // Hand a target back for reuse
+        void release(Buffer2D<T>* target)
+        {
+            if(target != NULL)
+            {
+                idle.push_back(target);
+                outstanding--;
+            }
+        }
+
+        // Free every idle target
+        void trim()
+        {
+            for(size_t i = 0; i < idle.size(); i++)
+            {
+                delete idle[i];
+            }
+            idle.clear();
+        }
+
+        // Free idle targets of any size other than 'wid' x 'hgt'
+        void trim(const int & wid, const int & hgt)
+        {
+            size_t kept = 0;
+            for(size_t i = 0; i < idle.size(); i++)
+            {
+                if(idle[i]->width() == wid && idle[i]->height() == hgt)
+                {
+                    idle[kept++] = idle[i];
+                }
+                else
+                {
+                    delete idle[i];
+                }
+            }
+            idle.resize(kept);
+        }
+
+        int idleCount()  { return (int)idle.size(); }
+        int inUseCount() { return outstanding; }
+};
+
+// Shared pool per element type
+template <class T>
+RenderTargetPool<T> & TargetPool()
+{
+    static RenderTargetPool<T> pool;
+    return pool;
+}
+
+/****************************************************
+ * POOLED_TARGET:
+ * Scoped handle to a pooled target, released on
+ * destruction. Movable, not copyable.
+ ***************************************************/
+template <class T>
+class PooledTarget
+{
+    protected:
+        RenderTargetPool<T>* pool;
+        Buffer2D<T>* target;
+
+        PooledTarget(const PooledTarget &);
+        PooledTarget& operator=(const PooledTarget &);
+
+    public:
+        PooledTarget(const int & wid, const int & hgt, const bool & zero = false, RenderTargetPool<T> & from = TargetPool<T>())
+        {
+            pool = &from;
+            target = pool->acquire(wid, hgt, zero);
+        }
+
+        PooledTarget(PooledTarget && other)
+        {
+            pool = other.pool;
+            target = other.target;
+            other.target = NULL;
+        }
+
+        PooledTarget& operator=(PooledTarget && other)
+        {
+            if(this != &other)
+            {
+                pool->release(target);
+                pool = other.pool;
+                target = other.target;
+                other.target = NULL;
+            }
+            return *this;
+        }
+
+        ~PooledTarget()
+        {
+            pool->release(target);
+        }
+
+        Buffer2D<T> & operator*()  { return *target; }
+        Buffer2D<T>* operator->() { return target; }
+        Buffer2D<T>* get()        { return target; }
+};
+
+#endif
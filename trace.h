@@ -0,0 +1,372 @@
+#include "definitions.h"
+#ifdef PIPELINE_TRACE
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#endif
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/******************************************************
+ * TRACING:
+ * Timeline of pipeline stages in Chrome trace-event
+ * format (chrome://tracing, Perfetto). Compiled in
+ * with PIPELINE_TRACE only, otherwise every TRACE_
+ * macro expands to nothing. When compiled in,
+ * recording still starts off and is switched at
+ * runtime with TRACE_ENABLE or TRACE_TOGGLE.
+ *
+ *      TRACE_SCOPE("name");           Times the enclosing scope
+ *      TRACE_NEXT_FRAME();            Starts the next frame number
+ *      TRACE_THREAD_NAME("name");     Labels the calling thread
+ *      TRACE_ENABLE(on);              Starts/stops recording
+ *      TRACE_TOGGLE("trace.json");    Starts, or stops and exports
+ *                                     the frames recorded since
+ *      TRACE_EXPORT(path, first, last);
+ *
+ * Names must be string literals (only the pointer is
+ * stored). Each thread records into its own ring of
+ * the last TRACE_RING_EVENTS events without locking,
+ * taken on its first recorded event.
+ *****************************************************/
+#ifdef PIPELINE_TRACE
+
+#define TRACE_RING_EVENTS 65536         // Power of two
+#define TRACE_NAME_LENGTH 32
+
+#define TRACE_CONCAT_INNER(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_INNER(A, B)
+#define TRACE_SCOPE(NAME) TraceScope TRACE_CONCAT(traceScope, __LINE__)(NAME)
+#define TRACE_NEXT_FRAME() TraceNextFrame()
+#define TRACE_THREAD_NAME(NAME) TraceThreadName(NAME)
+#define TRACE_ENABLE(ON) TraceEnable(ON)
+#define TRACE_TOGGLE(PATH) TraceToggle(PATH)
+#define TRACE_EXPORT(PATH, FIRST, LAST) TraceExport(PATH, FIRST, LAST)
+
+struct TraceEvent
+{
+    const char* name;
+    Uint64 start;                       // ns since the trace clock's origin
+    Uint64 end;
+    Uint32 frame;
+};
+
+// Ring slot, fields are atomics so the exporter may read while the owner writes
+struct TraceSlot
+{
+    std::atomic<const char*> name;
+    std::atomic<Uint64> start;
+    std::atomic<Uint64> end;
+    std::atomic<Uint32> frame;
+};
+
+/****************************************************
+ * TRACE_RING:
+ * Events of one thread, written only by that thread.
+ * 'head' counts every event ever written, it is
+ * published after the event so readers see whole
+ * events. A ring outlives its thread and is handed
+ * to the next new thread with its tid and name, so
+ * tids stay bounded by the most threads ever alive
+ * at once. TRACE_THREAD_NAME renames it.
+ ***************************************************/
+struct TraceRing
+{
+    TraceSlot events[TRACE_RING_EVENTS];
+    std::atomic<Uint64> head;
+    std::atomic<bool> inUse;
+    int tid;
+    char name[TRACE_NAME_LENGTH];       // Written and exported under the state lock
+};
+
+/****************************************************
+ * TRACE_STATE:
+ * Process wide switches, frame number and the list
+ * of rings. The lock is only taken when a thread
+ * first records, when it is named and when
+ * exporting.
+ ***************************************************/
+struct TraceState
+{
+    std::atomic<bool> enabled;
+    std::atomic<Uint32> frame;
+    Uint32 firstFrame;                  // Of the current TRACE_TOGGLE recording
+    std::mutex lock;
+    std::vector<TraceRing*> rings;
+    std::chrono::steady_clock::time_point origin;
+
+    TraceState()
+    {
+        enabled = false;
+        frame = 0;
+        firstFrame = 0;
+        origin = std::chrono::steady_clock::now();
+    }
+
+    ~TraceState()
+    {
+        for(size_t i = 0; i < rings.size(); i++)
+        {
+            delete rings[i];
+        }
+    }
+};
+
+inline TraceState & TraceGlobals()
+{
+    static TraceState state;
+    return state;
+}
+
+inline Uint64 TraceNow()
+{
+    return (Uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - TraceGlobals().origin).count();
+}
+
+// Ring and name of the calling thread, the ring returns to the pool when the thread exits
+struct TraceRingOwner
+{
+    TraceRing* ring;
+    char name[TRACE_NAME_LENGTH];
+
+    TraceRingOwner()
+    {
+        ring = NULL;
+        name[0] = '\0';
+    }
+
+    // A free ring with its tid, or a new one
+    TraceRing* acquire()
+    {
+        TraceState & state = TraceGlobals();
+        std::lock_guard<std::mutex> guard(state.lock);
+        for(size_t i = 0; i < state.rings.size() && ring == NULL; i++)
+        {
+            if(!state.rings[i]->inUse)
+            {
+                ring = state.rings[i];
+            }
+        }
+        if(ring == NULL)
+        {
+            ring = new TraceRing();
+            ring->head = 0;
+            ring->tid = (int)state.rings.size() + 1;
+            snprintf(ring->name, TRACE_NAME_LENGTH, "thread %d", ring->tid);
+            state.rings.push_back(ring);
+        }
+        if(name[0] != '\0')
+        {
+            snprintf(ring->name, TRACE_NAME_LENGTH, "%s", name);
+        }
+        ring->inUse = true;
+        return ring;
+    }
+
+    ~TraceRingOwner()
+    {
+        if(ring != NULL)
+        {
+            ring->inUse = false;
+        }
+    }
+};
+
+inline TraceRingOwner & TraceThreadOwner()
+{
+    static thread_local TraceRingOwner owner;
+    return owner;
+}
+
+/****************************************************
+ * TRACE_RECORD
+ * Appends an event to the calling thread's ring. The
+ * release fence keeps the slot's stores after the
+ * previous head store, so an exporter that loads any
+ * of them also sees head moved to this event, see
+ * TraceExport.
+ ***************************************************/
+inline void TraceRecord(const char* name, const Uint32 & frame, const Uint64 & start, const Uint64 & end)
+{
+    TraceRingOwner & owner = TraceThreadOwner();
+    TraceRing* ring = (owner.ring != NULL) ? owner.ring : owner.acquire();
+    Uint64 i = ring->head.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceSlot & e = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    e.name.store(name, std::memory_order_relaxed);
+    e.start.store(start, std::memory_order_relaxed);
+    e.end.store(end, std::memory_order_relaxed);
+    e.frame.store(frame, std::memory_order_relaxed);
+    ring->head.store(i + 1, std::memory_order_release);
+}
+
+/****************************************************
+ * TRACE_SCOPE:
+ * Records the time from construction to destruction
+ * as one complete event, if tracing was on when the
+ * scope began. One relaxed load when it was off.
+ ***************************************************/
+class TraceScope
+{
+    protected:
+        const char* name;
+        Uint64 start;
+        Uint32 frame;
+        bool active;
+
+    public:
+        TraceScope(const char* scopeName)
+        {
+            active = TraceGlobals().enabled.load(std::memory_order_relaxed);
+            if(active)
+            {
+                name = scopeName;
+                frame = TraceGlobals().frame.load(std::memory_order_relaxed);
+                start = TraceNow();
+            }
+        }
+
+        ~TraceScope()
+        {
+            if(active)
+            {
+                TraceRecord(name, frame, start, TraceNow());
+            }
+        }
+};
+
+inline void TraceNextFrame()
+{
+    TraceGlobals().frame++;
+}
+
+// Labels the calling thread without taking a ring, that waits for its first event
+inline void TraceThreadName(const char* name)
+{
+    TraceRingOwner & owner = TraceThreadOwner();
+    snprintf(owner.name, TRACE_NAME_LENGTH, "%s", name);
+    if(owner.ring != NULL)
+    {
+        TraceState & state = TraceGlobals();
+        std::lock_guard<std::mutex> guard(state.lock);
+        snprintf(owner.ring->name, TRACE_NAME_LENGTH, "%s", name);
+    }
+}
+
+inline void TraceEnable(const bool & on)
+{
+    TraceGlobals().enabled = on;
+}
+
+// Writes a JSON string body, escaping what JSON requires
+inline void TraceWriteString(FILE* out, const char* s)
+{
+    for(; *s != '\0'; s++)
+    {
+        if(*s == '"' || *s == '\\')
+        {
+            fputc('\\', out);
+        }
+        if((unsigned char)*s >= 0x20)
+        {
+            fputc(*s, out);
+        }
+    }
+}
+
+/****************************************************
+ * TRACE_EXPORT
+ * Writes the recorded events of frames [first, last]
+ * still held by the rings as Chrome trace JSON. May
+ * run while other threads record: ring slots are
+ * copied like a seqlock read with relaxed loads. A
+ * slot the writer reached during the copy may mix
+ * two events, head read after the copy (behind an
+ * acquire fence) tells which ones, those are left
+ * out.
+ ***************************************************/
+bool TraceExport(const char* path, const Uint32 & firstFrame, const Uint32 & lastFrame)
+{
+    FILE* out = fopen(path, "w");
+    if(out == NULL)
+    {
+        return false;
+    }
+
+    TraceState & state = TraceGlobals();
+    std::lock_guard<std::mutex> guard(state.lock);
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+    bool first = true;
+    std::vector<TraceEvent> copied;
+    for(size_t r = 0; r < state.rings.size(); r++)
+    {
+        TraceRing* ring = state.rings[r];
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",\n", ring->tid);
+        TraceWriteString(out, ring->name);
+        fputs("\"}}", out);
+        first = false;
+
+        // Copy first, then drop whatever the writer may have lapped meanwhile
+        Uint64 head = ring->head.load(std::memory_order_acquire);
+        Uint64 begin = (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0;
+        copied.clear();
+        for(Uint64 i = begin; i < head; i++)
+        {
+            const TraceSlot & slot = ring->events[i & (TRACE_RING_EVENTS - 1)];
+            TraceEvent e;
+            e.name = slot.name.load(std::memory_order_relaxed);
+            e.start = slot.start.load(std::memory_order_relaxed);
+            e.end = slot.end.load(std::memory_order_relaxed);
+            e.frame = slot.frame.load(std::memory_order_relaxed);
+            copied.push_back(e);
+        }
+        // Event 'after' may be mid-write, its slot held event after - TRACE_RING_EVENTS
+        std::atomic_thread_fence(std::memory_order_acquire);
+        Uint64 after = ring->head.load(std::memory_order_relaxed);
+        Uint64 safe = (after + 1 > TRACE_RING_EVENTS) ? after + 1 - TRACE_RING_EVENTS : 0;
+
+        for(size_t i = 0; i < copied.size(); i++)
+        {
+            const TraceEvent & e = copied[i];
+            if(begin + i < safe || e.frame < firstFrame || e.frame > lastFrame)
+            {
+                continue;
+            }
+            fputs(",\n{\"name\":\"", out);
+            TraceWriteString(out, e.name);
+            fprintf(out, "\",\"cat\":\"pipeline\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+                    ring->tid, e.start / 1000.0, (e.end - e.start) / 1000.0, e.frame);
+        }
+    }
+    fputs("\n]}\n", out);
+    return fclose(out) == 0;
+}
+
+// Starts recording at the current frame, or stops and exports what was recorded
+inline bool TraceToggle(const char* path)
+{
+    TraceState & state = TraceGlobals();
+    if(!state.enabled)
+    {
+        state.firstFrame = state.frame;
+        state.enabled = true;
+        return true;
+    }
+    state.enabled = false;
+    return TraceExport(path, state.firstFrame, state.frame);
+}
+
+#else
+
+#define TRACE_SCOPE(NAME)
+#define TRACE_NEXT_FRAME()
+#define TRACE_THREAD_NAME(NAME)
+#define TRACE_ENABLE(ON)
+#define TRACE_TOGGLE(PATH)
+#define TRACE_EXPORT(PATH, FIRST, LAST)
+
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+#include "definitions.h"
+#include "trace.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+/******************************************************
+ * DEFINES:
+ * Most threads a pool keeps, parts of a job beyond
+ * the threads are taken in turn.
+ *****************************************************/
+#define WORKER_POOL_MAX_THREADS 64
+
+/****************************************************
+ * WORKER_POOL:
+ * Persistent threads for the parallel stages. run()
+ * splits a job into 'parts' calls job(context, part),
+ * taken in turn by the calling thread and up to
+ * parts - 1 workers, and returns once all are done.
+ * Workers start on first need and are kept, so a
+ * frame pays no thread creation. Workers carry no
+ * raster state, jobs set their own scissor and depth
+ * test. One run at a time, a job must not run() the
+ * same pool.
+ ***************************************************/
+class WorkerPool
+{
+    protected:
+        std::vector<std::thread> threads;
+        std::mutex runLock;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        void (*job)(void* context, const int & part);
+        void* context;
+        int parts;
+        std::atomic<int> nextPart;
+        int wanted;                     // Workers still to join the current run
+        int active;                     // Participants not done with it
+        Uint64 generation;
+        bool quit;
+
+        WorkerPool(const WorkerPool &);
+        WorkerPool& operator=(const WorkerPool &);
+
+        // Take parts until none are left
+        void work()
+        {
+            for(int part = nextPart++; part < parts; part = nextPart++)
+            {
+                job(context, part);
+            }
+        }
+
+        void workerLoop()
+        {
+            TRACE_THREAD_NAME("worker");
+            Uint64 seen = 0;
+            std::unique_lock<std::mutex> guard(lock);
+            while(true)
+            {
+                wake.wait(guard, [&]{ return quit || generation != seen; });
+                if(quit)
+                {
+                    return;
+                }
+                seen = generation;
+                if(wanted == 0)
+                {
+                    continue;
+                }
+                wanted--;
+                guard.unlock();
+                work();
+                guard.lock();
+                if(--active == 0)
+                {
+                    finished.notify_one();
+                }
+            }
+        }
+
+    public:
+        WorkerPool()
+        {
+#ifdef PIPELINE_TRACE
+            // Constructed first so it outlives the workers' trace rings
+            TraceGlobals();
+#endif
+            job = NULL;
+            context = NULL;
+            parts = 0;
+            nextPart = 0;
+            wanted = 0;
+            active = 0;
+            generation = 0;
+            quit = false;
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                quit = true;
+            }
+            wake.notify_all();
+            for(size_t t = 0; t < threads.size(); t++)
+            {
+                threads[t].join();
+            }
+        }
+
+        int size() { return (int)threads.size(); }
+
+        void run(void (*jobFunc)(void* context, const int & part), void* jobContext, const int & numParts)
+        {
+            if(numParts <= 1)
+            {
+                for(int part = 0; part < numParts; part++)
+                {
+                    jobFunc(jobContext, part);
+                }
+                return;
+            }
+
+            std::lock_guard<std::mutex> running(runLock);
+            int helpers = MIN(numParts - 1, WORKER_POOL_MAX_THREADS);
+            while((int)threads.size() < helpers)
+            {
+                threads.push_back(std::thread(&WorkerPool::workerLoop, this));
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                job = jobFunc;
+                context = jobContext;
+                parts = numParts;
+                nextPart = 0;
+                wanted = helpers;
+                active = helpers + 1;
+                generation++;
+            }
+            wake.notify_all();
+
+            work();
+            std::unique_lock<std::mutex> guard(lock);
+            active--;
+            finished.wait(guard, [&]{ return active == 0; });
+            wanted = 0;
+        }
+};
+
+// Shared pool of the pipeline's threaded stages
+inline WorkerPool & SharedWorkers()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+#endif